@@ -0,0 +1,317 @@
+/*
+ * apply.c
+ *
+ * Mode switches on a worker thread. Retraining a link may keep the X
+ * server busy for seconds, so requests are handed to a thread with a
+ * Display connection of its own and completion is reported back to the
+ * main loop.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+#include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
+
+#include "gresolutions.h"
+
+struct transaction_entry {
+	RROutput output;
+	RRMode mode;
+	int x, y;
+};
+
+struct transaction {
+	GArray *entries;	/* struct transaction_entry, one per output */
+};
+
+struct apply {
+	RROutput output;
+	RRMode mode;
+	struct transaction *transaction;	/* instead of output and mode */
+	unsigned int flags;
+	int status;
+	gboolean skipped;
+	gint64 reply_time;	/* monotonic, when the server answered */
+	apply_done_func done;
+	gpointer user_data;
+};
+
+static GAsyncQueue *queue;
+
+static void transaction_free(struct transaction *t)
+{
+	g_array_free(t->entries, TRUE);
+	g_free(t);
+}
+
+static gboolean apply_report(gpointer data)
+{
+	struct apply *apply = data;
+
+	apply->done(apply->output, apply->mode, apply->status, apply->skipped,
+		    apply->reply_time, apply->user_data);
+	if (apply->transaction)
+		transaction_free(apply->transaction);
+	g_free(apply);
+
+	return G_SOURCE_REMOVE;
+}
+
+static int outputs_contain(const RROutput *outputs, int n, RROutput output)
+{
+	int k;
+
+	for (k = 0; k < n; ++k) {
+		if (outputs[k] == output)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Turn the entries of t into changes of the CRTCs the outputs are on
+ * in res, one per CRTC. A change starts out from what the CRTC shows,
+ * so it keeps its rotation and the other outputs it drives. Returns
+ * the number of changes, -1 if an output has no CRTC or outputs on
+ * one CRTC are given different modes or positions. The output lists
+ * of the changes are allocated, see transaction_changes_free().
+ */
+static int transaction_changes(struct transaction *t,
+			       const struct resources *res,
+			       struct crtc_change *changes)
+{
+	unsigned int k;
+	int j, n = 0;
+
+	for (k = 0; k < t->entries->len; ++k) {
+		struct transaction_entry *entry =
+		    &g_array_index(t->entries, struct transaction_entry, k);
+		struct output_info *output_info =
+		    resources_find_output(res, entry->output);
+		struct crtc_info *crtc_info = NULL;
+		struct crtc_change *change;
+
+		if (output_info)
+			crtc_info = resources_find_crtc(res, output_info->crtc);
+		if (!crtc_info)
+			return -1;
+
+		for (j = 0; j < n; ++j) {
+			if (changes[j].crtc == crtc_info->id)
+				break;
+		}
+		change = &changes[j];
+
+		if (j < n) {
+			if (change->mode != entry->mode ||
+			    change->x != entry->x || change->y != entry->y)
+				return -1;
+		} else {
+			change->crtc = crtc_info->id;
+			change->mode = entry->mode;
+			change->x = entry->x;
+			change->y = entry->y;
+			change->rotation = crtc_info->rotation;
+			change->outputs = g_new(RROutput, crtc_info->noutput +
+						t->entries->len);
+			change->noutput = crtc_info->noutput;
+			memcpy(change->outputs, crtc_info->outputs,
+			       crtc_info->noutput * sizeof(RROutput));
+			n++;
+		}
+
+		if (!outputs_contain(change->outputs, change->noutput,
+				     entry->output))
+			change->outputs[change->noutput++] = entry->output;
+	}
+
+	/* a CRTC that is turned off drives no outputs */
+	for (j = 0; j < n; ++j) {
+		if (!changes[j].mode)
+			changes[j].noutput = 0;
+	}
+
+	return n;
+}
+
+static void transaction_changes_free(struct crtc_change *changes, int n)
+{
+	int k;
+
+	for (k = 0; k < n; ++k)
+		g_free(changes[k].outputs);
+	g_free(changes);
+}
+
+static void transaction_run(xcb_connection_t *c, xcb_window_t root,
+			    struct apply *apply)
+{
+	struct transaction *t = apply->transaction;
+	struct crtc_change *changes = g_new0(struct crtc_change,
+					     t->entries->len);
+	struct resources *res = resources_read_lock();
+	int n = c ? transaction_changes(t, res, changes) : -1;
+
+	/* the snapshot has to stay for the rollback */
+	if (n < 0)
+		apply->status = -1;
+	else
+		apply->status = crtcs_configure(c, root, res, changes, n);
+
+	resources_read_unlock();
+	/* unused changes have no output list */
+	transaction_changes_free(changes, t->entries->len);
+}
+
+static void apply_one(xcb_connection_t *c, struct apply *apply)
+{
+	struct resources *res = resources_read_lock();
+	struct output_info *output_info =
+	    resources_find_output(res, apply->output);
+	struct crtc_info *crtc_info = NULL;
+	Time config_timestamp = res->config_timestamp;
+	RRCrtc crtc = None;
+
+	if (output_info)
+		crtc_info = resources_find_crtc(res, output_info->crtc);
+	if (crtc_info)
+		crtc = crtc_info->id;
+
+	/* the mode may have become active while the request was queued */
+	if (crtc_info && crtc_info->mode == apply->mode &&
+	    !(apply->flags & APPLY_FORCE)) {
+		resources_read_unlock();
+		apply->status = 0;
+		apply->skipped = TRUE;
+		return;
+	}
+
+	/* don't keep the snapshot from being reclaimed during the switch */
+	resources_read_unlock();
+
+	if (!c || !crtc)
+		apply->status = -1;
+	else
+		apply->status = crtc_set_mode(c, config_timestamp, crtc,
+					      apply->output, apply->mode);
+}
+
+static gpointer apply_thread(gpointer data)
+{
+	char *display_name = data;
+	Display *dpy = XOpenDisplay(display_name);
+	xcb_connection_t *c = dpy ? XGetXCBConnection(dpy) : NULL;
+	xcb_window_t root = dpy ? DefaultRootWindow(dpy) : None;
+
+	if (!dpy)
+		g_warning("apply worker cannot open display %s\n",
+			  display_name);
+	g_free(display_name);
+
+	for (;;) {
+		struct apply *apply = g_async_queue_pop(queue);
+
+		if (apply->transaction)
+			transaction_run(c, root, apply);
+		else
+			apply_one(c, apply);
+		apply->reply_time = g_get_monotonic_time();
+		g_main_context_invoke(NULL, apply_report, apply);
+	}
+
+	return NULL;
+}
+
+void apply_init(const char *display_name)
+{
+	GThread *thread;
+
+	queue = g_async_queue_new();
+	thread = g_thread_new("apply", apply_thread, g_strdup(display_name));
+	g_thread_unref(thread);
+}
+
+/*
+ * Queue setting mode on output. done is called from the main loop once
+ * the server replied, status is 0 on success. Without APPLY_FORCE the
+ * request is not sent if the current snapshot has mode active already,
+ * done is then called with status 0 and skipped set.
+ */
+void apply_mode(RROutput output, RRMode mode, unsigned int flags,
+		apply_done_func done, gpointer user_data)
+{
+	struct apply *apply = g_new0(struct apply, 1);
+
+	apply->output = output;
+	apply->mode = mode;
+	apply->flags = flags;
+	apply->done = done;
+	apply->user_data = user_data;
+
+	g_async_queue_push(queue, apply);
+}
+
+/*
+ * Layout changes across outputs, collected with transaction_set() and
+ * applied as a whole by transaction_commit(), see crtcs_configure().
+ */
+struct transaction *transaction_new(void)
+{
+	struct transaction *t = g_new0(struct transaction, 1);
+
+	t->entries = g_array_new(FALSE, FALSE,
+				 sizeof(struct transaction_entry));
+
+	return t;
+}
+
+/* show mode at x, y on the CRTC output is on, None turns it off */
+void transaction_set(struct transaction *t, RROutput output, RRMode mode,
+		     int x, int y)
+{
+	struct transaction_entry entry = { output, mode, x, y };
+	unsigned int k;
+
+	for (k = 0; k < t->entries->len; ++k) {
+		if (g_array_index(t->entries, struct transaction_entry,
+				  k).output == output) {
+			g_array_index(t->entries, struct transaction_entry,
+				      k) = entry;
+			return;
+		}
+	}
+	g_array_append_val(t->entries, entry);
+}
+
+/*
+ * Queue t, which is consumed. done is called from the main loop once,
+ * with the first output and mode set, status is 0 if the whole layout
+ * was applied and nonzero if it was rolled back.
+ */
+void transaction_commit(struct transaction *t, apply_done_func done,
+			gpointer user_data)
+{
+	struct apply *apply = g_new0(struct apply, 1);
+
+	if (t->entries->len) {
+		struct transaction_entry *first =
+		    &g_array_index(t->entries, struct transaction_entry, 0);
+
+		apply->output = first->output;
+		apply->mode = first->mode;
+	}
+	apply->transaction = t;
+	apply->done = done;
+	apply->user_data = user_data;
+
+	g_async_queue_push(queue, apply);
+}
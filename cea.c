@@ -0,0 +1,369 @@
+/*
+ * cea.c
+ *
+ * CEA-861 extension blocks: short video descriptors, HDMI TMDS limits and
+ * YCbCr 4:2:0 support. VICs are resolved against a constant table.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+#define CEA_EXTENSION_TAG 0x02
+
+/* data block tags */
+#define CEA_VIDEO_BLOCK 2
+#define CEA_VENDOR_BLOCK 3
+#define CEA_EXTENDED_BLOCK 7
+
+/* extended data block tags */
+#define CEA_YCBCR420_VIDEO_BLOCK 14
+#define CEA_YCBCR420_CAPABILITY_MAP 15
+
+#define HDMI_OUI 0x000c03
+#define HDMI_FORUM_OUI 0xc45dd8
+
+#define PP (RR_HSyncPositive | RR_VSyncPositive)
+#define NN (RR_HSyncNegative | RR_VSyncNegative)
+#define PN (RR_HSyncPositive | RR_VSyncNegative)
+#define I RR_Interlace
+
+/*
+ * CEA-861-F video identification codes. Pixel repeated formats are
+ * listed with the doubled width and clock, which is how X exposes them.
+ */
+static const struct cea_vic cea_vics[] = {
+	[1] = { 25175, 640, 656, 752, 800, 480, 490, 492, 525, NN },
+	[2] = { 27000, 720, 736, 798, 858, 480, 489, 495, 525, NN },
+	[3] = { 27000, 720, 736, 798, 858, 480, 489, 495, 525, NN },
+	[4] = { 74250, 1280, 1390, 1430, 1650, 720, 725, 730, 750, PP },
+	[5] = { 74250, 1920, 2008, 2052, 2200, 1080, 1084, 1094, 1125, PP | I },
+	[6] = { 27000, 1440, 1478, 1602, 1716, 480, 488, 494, 525, NN | I },
+	[7] = { 27000, 1440, 1478, 1602, 1716, 480, 488, 494, 525, NN | I },
+	[8] = { 27000, 1440, 1478, 1602, 1716, 240, 244, 247, 262, NN },
+	[9] = { 27000, 1440, 1478, 1602, 1716, 240, 244, 247, 262, NN },
+	[10] = { 54000, 2880, 2956, 3204, 3432, 480, 488, 494, 525, NN | I },
+	[11] = { 54000, 2880, 2956, 3204, 3432, 480, 488, 494, 525, NN | I },
+	[12] = { 54000, 2880, 2956, 3204, 3432, 240, 244, 247, 262, NN },
+	[13] = { 54000, 2880, 2956, 3204, 3432, 240, 244, 247, 262, NN },
+	[14] = { 54000, 1440, 1472, 1596, 1716, 480, 489, 495, 525, NN },
+	[15] = { 54000, 1440, 1472, 1596, 1716, 480, 489, 495, 525, NN },
+	[16] = { 148500, 1920, 2008, 2052, 2200, 1080, 1084, 1089, 1125, PP },
+	[17] = { 27000, 720, 732, 796, 864, 576, 581, 586, 625, NN },
+	[18] = { 27000, 720, 732, 796, 864, 576, 581, 586, 625, NN },
+	[19] = { 74250, 1280, 1720, 1760, 1980, 720, 725, 730, 750, PP },
+	[20] = { 74250, 1920, 2448, 2492, 2640, 1080, 1084, 1094, 1125, PP | I },
+	[21] = { 27000, 1440, 1464, 1590, 1728, 576, 580, 586, 625, NN | I },
+	[22] = { 27000, 1440, 1464, 1590, 1728, 576, 580, 586, 625, NN | I },
+	[23] = { 27000, 1440, 1464, 1590, 1728, 288, 290, 293, 312, NN },
+	[24] = { 27000, 1440, 1464, 1590, 1728, 288, 290, 293, 312, NN },
+	[25] = { 54000, 2880, 2928, 3180, 3456, 576, 580, 586, 625, NN | I },
+	[26] = { 54000, 2880, 2928, 3180, 3456, 576, 580, 586, 625, NN | I },
+	[27] = { 54000, 2880, 2928, 3180, 3456, 288, 290, 293, 312, NN },
+	[28] = { 54000, 2880, 2928, 3180, 3456, 288, 290, 293, 312, NN },
+	[29] = { 54000, 1440, 1464, 1592, 1728, 576, 581, 586, 625, NN },
+	[30] = { 54000, 1440, 1464, 1592, 1728, 576, 581, 586, 625, NN },
+	[31] = { 148500, 1920, 2448, 2492, 2640, 1080, 1084, 1089, 1125, PP },
+	[32] = { 74250, 1920, 2558, 2602, 2750, 1080, 1084, 1089, 1125, PP },
+	[33] = { 74250, 1920, 2448, 2492, 2640, 1080, 1084, 1089, 1125, PP },
+	[34] = { 74250, 1920, 2008, 2052, 2200, 1080, 1084, 1089, 1125, PP },
+	[35] = { 108000, 2880, 2944, 3192, 3432, 480, 489, 495, 525, NN },
+	[36] = { 108000, 2880, 2944, 3192, 3432, 480, 489, 495, 525, NN },
+	[37] = { 108000, 2880, 2928, 3184, 3456, 576, 581, 586, 625, NN },
+	[38] = { 108000, 2880, 2928, 3184, 3456, 576, 581, 586, 625, NN },
+	[39] = { 72000, 1920, 1952, 2120, 2304, 1080, 1126, 1136, 1250, PN | I },
+	[40] = { 148500, 1920, 2448, 2492, 2640, 1080, 1084, 1094, 1125, PP | I },
+	[41] = { 148500, 1280, 1720, 1760, 1980, 720, 725, 730, 750, PP },
+	[42] = { 54000, 720, 732, 796, 864, 576, 581, 586, 625, NN },
+	[43] = { 54000, 720, 732, 796, 864, 576, 581, 586, 625, NN },
+	[44] = { 54000, 1440, 1464, 1590, 1728, 576, 580, 586, 625, NN | I },
+	[45] = { 54000, 1440, 1464, 1590, 1728, 576, 580, 586, 625, NN | I },
+	[46] = { 148500, 1920, 2008, 2052, 2200, 1080, 1084, 1094, 1125, PP | I },
+	[47] = { 148500, 1280, 1390, 1430, 1650, 720, 725, 730, 750, PP },
+	[48] = { 54000, 720, 736, 798, 858, 480, 489, 495, 525, NN },
+	[49] = { 54000, 720, 736, 798, 858, 480, 489, 495, 525, NN },
+	[50] = { 54000, 1440, 1478, 1602, 1716, 480, 488, 494, 525, NN | I },
+	[51] = { 54000, 1440, 1478, 1602, 1716, 480, 488, 494, 525, NN | I },
+	[52] = { 108000, 720, 732, 796, 864, 576, 581, 586, 625, NN },
+	[53] = { 108000, 720, 732, 796, 864, 576, 581, 586, 625, NN },
+	[54] = { 108000, 1440, 1464, 1590, 1728, 576, 580, 586, 625, NN | I },
+	[55] = { 108000, 1440, 1464, 1590, 1728, 576, 580, 586, 625, NN | I },
+	[56] = { 108000, 720, 736, 798, 858, 480, 489, 495, 525, NN },
+	[57] = { 108000, 720, 736, 798, 858, 480, 489, 495, 525, NN },
+	[58] = { 108000, 1440, 1478, 1602, 1716, 480, 488, 494, 525, NN | I },
+	[59] = { 108000, 1440, 1478, 1602, 1716, 480, 488, 494, 525, NN | I },
+	[60] = { 59400, 1280, 3040, 3080, 3300, 720, 725, 730, 750, PP },
+	[61] = { 74250, 1280, 3700, 3740, 3960, 720, 725, 730, 750, PP },
+	[62] = { 74250, 1280, 3040, 3080, 3300, 720, 725, 730, 750, PP },
+	[63] = { 297000, 1920, 2008, 2052, 2200, 1080, 1084, 1089, 1125, PP },
+	[64] = { 297000, 1920, 2448, 2492, 2640, 1080, 1084, 1089, 1125, PP },
+	[65] = { 59400, 1280, 3040, 3080, 3300, 720, 725, 730, 750, PP },
+	[66] = { 74250, 1280, 3700, 3740, 3960, 720, 725, 730, 750, PP },
+	[67] = { 74250, 1280, 3040, 3080, 3300, 720, 725, 730, 750, PP },
+	[68] = { 74250, 1280, 1720, 1760, 1980, 720, 725, 730, 750, PP },
+	[69] = { 74250, 1280, 1390, 1430, 1650, 720, 725, 730, 750, PP },
+	[70] = { 148500, 1280, 1720, 1760, 1980, 720, 725, 730, 750, PP },
+	[71] = { 148500, 1280, 1390, 1430, 1650, 720, 725, 730, 750, PP },
+	[72] = { 74250, 1920, 2558, 2602, 2750, 1080, 1084, 1089, 1125, PP },
+	[73] = { 74250, 1920, 2448, 2492, 2640, 1080, 1084, 1089, 1125, PP },
+	[74] = { 74250, 1920, 2008, 2052, 2200, 1080, 1084, 1089, 1125, PP },
+	[75] = { 148500, 1920, 2448, 2492, 2640, 1080, 1084, 1089, 1125, PP },
+	[76] = { 148500, 1920, 2008, 2052, 2200, 1080, 1084, 1089, 1125, PP },
+	[77] = { 297000, 1920, 2448, 2492, 2640, 1080, 1084, 1089, 1125, PP },
+	[78] = { 297000, 1920, 2008, 2052, 2200, 1080, 1084, 1089, 1125, PP },
+	[79] = { 59400, 1680, 3040, 3080, 3300, 720, 725, 730, 750, PP },
+	[80] = { 59400, 1680, 2908, 2948, 3168, 720, 725, 730, 750, PP },
+	[81] = { 59400, 1680, 2380, 2420, 2640, 720, 725, 730, 750, PP },
+	[82] = { 82500, 1680, 1940, 1980, 2200, 720, 725, 730, 750, PP },
+	[83] = { 99000, 1680, 1940, 1980, 2200, 720, 725, 730, 750, PP },
+	[84] = { 165000, 1680, 1740, 1780, 2000, 720, 725, 730, 825, PP },
+	[85] = { 198000, 1680, 1740, 1780, 2000, 720, 725, 730, 825, PP },
+	[86] = { 99000, 2560, 3558, 3602, 3750, 1080, 1084, 1089, 1100, PP },
+	[87] = { 90000, 2560, 3008, 3052, 3200, 1080, 1084, 1089, 1125, PP },
+	[88] = { 118800, 2560, 3328, 3372, 3520, 1080, 1084, 1089, 1125, PP },
+	[89] = { 185625, 2560, 3108, 3152, 3300, 1080, 1084, 1089, 1125, PP },
+	[90] = { 198000, 2560, 2808, 2852, 3000, 1080, 1084, 1089, 1100, PP },
+	[91] = { 371250, 2560, 2778, 2822, 2970, 1080, 1084, 1089, 1250, PP },
+	[92] = { 495000, 2560, 3108, 3152, 3300, 1080, 1084, 1089, 1250, PP },
+	[93] = { 297000, 3840, 5116, 5204, 5500, 2160, 2168, 2178, 2250, PP },
+	[94] = { 297000, 3840, 4896, 4984, 5280, 2160, 2168, 2178, 2250, PP },
+	[95] = { 297000, 3840, 4016, 4104, 4400, 2160, 2168, 2178, 2250, PP },
+	[96] = { 594000, 3840, 4896, 4984, 5280, 2160, 2168, 2178, 2250, PP },
+	[97] = { 594000, 3840, 4016, 4104, 4400, 2160, 2168, 2178, 2250, PP },
+	[98] = { 297000, 4096, 5116, 5204, 5500, 2160, 2168, 2178, 2250, PP },
+	[99] = { 297000, 4096, 5064, 5152, 5280, 2160, 2168, 2178, 2250, PP },
+	[100] = { 297000, 4096, 4184, 4272, 4400, 2160, 2168, 2178, 2250, PP },
+	[101] = { 594000, 4096, 5064, 5152, 5280, 2160, 2168, 2178, 2250, PP },
+	[102] = { 594000, 4096, 4184, 4272, 4400, 2160, 2168, 2178, 2250, PP },
+	[103] = { 297000, 3840, 5116, 5204, 5500, 2160, 2168, 2178, 2250, PP },
+	[104] = { 297000, 3840, 4896, 4984, 5280, 2160, 2168, 2178, 2250, PP },
+	[105] = { 297000, 3840, 4016, 4104, 4400, 2160, 2168, 2178, 2250, PP },
+	[106] = { 594000, 3840, 4896, 4984, 5280, 2160, 2168, 2178, 2250, PP },
+	[107] = { 594000, 3840, 4016, 4104, 4400, 2160, 2168, 2178, 2250, PP },
+};
+
+#undef PP
+#undef NN
+#undef PN
+#undef I
+
+/* NULL for reserved and unknown codes */
+const struct cea_vic *cea_vic_get(unsigned int vic)
+{
+	if (vic >= G_N_ELEMENTS(cea_vics) || !cea_vics[vic].pixclock)
+		return NULL;
+
+	return &cea_vics[vic];
+}
+
+/* fill an XRRModeInfo from vic, the name is left to the caller */
+void cea_vic_mode_info(const struct cea_vic *vic, XRRModeInfo *mode_info)
+{
+	memset(mode_info, 0, sizeof(*mode_info));
+	mode_info->width = vic->hactive;
+	mode_info->height = vic->vactive;
+	mode_info->dotClock = vic->pixclock * 1000UL;
+	mode_info->hSyncStart = vic->hsync_start;
+	mode_info->hSyncEnd = vic->hsync_end;
+	mode_info->hTotal = vic->htotal;
+	mode_info->vSyncStart = vic->vsync_start;
+	mode_info->vSyncEnd = vic->vsync_end;
+	mode_info->vTotal = vic->vtotal;
+	mode_info->modeFlags = vic->flags;
+}
+
+/* returns the index of the new SVD, -1 if there is no room for it */
+static int svd_add(struct edid_cea *cea, unsigned char svd)
+{
+	struct cea_svd *s;
+
+	if (cea->nsvd == CEA_MAX_SVD)
+		return -1;
+
+	s = &cea->svds[cea->nsvd++];
+	memset(s, 0, sizeof(*s));
+
+	/* codes 129 to 192 are VICs 1 to 64 flagged native */
+	if (svd >= 129 && svd <= 192) {
+		s->vic = svd & 0x7f;
+		s->native = 1;
+	} else {
+		s->vic = svd;
+	}
+
+	return cea->nsvd - 1;
+}
+
+static void vendor_block(struct edid_cea *cea, const unsigned char *p,
+			 int len)
+{
+	unsigned int oui;
+
+	if (len < 3)
+		return;
+
+	oui = p[0] | p[1] << 8 | p[2] << 16;
+	if (oui == HDMI_OUI) {
+		cea->hdmi = 1;
+		/* in units of 5 MHz, byte 7 of the block */
+		if (len >= 7)
+			cea->max_tmds = p[6] * 5000;
+	} else if (oui == HDMI_FORUM_OUI && len >= 5) {
+		cea->hdmi_forum = 1;
+		cea->max_tmds_hf = p[4] * 5000;
+	}
+}
+
+static void ycbcr420_video_block(struct edid_cea *cea,
+				 const unsigned char *p, int len)
+{
+	int k;
+
+	/* these VICs are supported in 4:2:0 only */
+	for (k = 0; k < len; ++k) {
+		int index = svd_add(cea, p[k]);
+
+		if (index < 0)
+			break;
+		cea->svds[index].ycbcr420 = CEA_YCBCR420_ONLY;
+	}
+}
+
+/* bit n says the n-th SVD of the video blocks also does 4:2:0 */
+static void ycbcr420_capability_map(struct edid_cea *cea,
+				    const unsigned char *p, int len,
+				    const int *video, int nvideo)
+{
+	int k;
+
+	/* an empty map covers all of them */
+	for (k = 0; k < nvideo; ++k) {
+		/* dropped for lack of room, but it keeps its bit */
+		if (video[k] < 0)
+			continue;
+		if (!len || (k / 8 < len && p[k / 8] & (1 << (k % 8))))
+			cea->svds[video[k]].ycbcr420 = CEA_YCBCR420_ALSO;
+	}
+}
+
+static void cea_block_decode(struct edid_cea *cea, const unsigned char *b)
+{
+	int dtd_offset = b[2];
+	const unsigned char *p;
+	const unsigned char *map = NULL;
+	int map_len = 0;
+	int video[CEA_MAX_SVD];	/* SVDs of video blocks, for the map */
+	int nvideo = 0;
+
+	if (dtd_offset < 4 || dtd_offset > EDID_BLOCK_SIZE - 1)
+		dtd_offset = EDID_BLOCK_SIZE - 1;
+
+	cea->revision = b[1];
+	cea->underscan = !!(b[3] & 0x80);
+
+	/* data block collection */
+	for (p = b + 4; p < b + dtd_offset;) {
+		int tag = p[0] >> 5;
+		int len = p[0] & 0x1f;
+		int k;
+
+		if (p + 1 + len > b + dtd_offset)
+			break;
+
+		switch (tag) {
+		case CEA_VIDEO_BLOCK:
+			for (k = 0; k < len; ++k) {
+				int index = svd_add(cea, p[1 + k]);
+
+				if (nvideo < CEA_MAX_SVD)
+					video[nvideo++] = index;
+			}
+			break;
+		case CEA_VENDOR_BLOCK:
+			vendor_block(cea, p + 1, len);
+			break;
+		case CEA_EXTENDED_BLOCK:
+			if (len < 1)
+				break;
+			if (p[1] == CEA_YCBCR420_VIDEO_BLOCK) {
+				ycbcr420_video_block(cea, p + 2, len - 1);
+			} else if (p[1] == CEA_YCBCR420_CAPABILITY_MAP) {
+				map = p + 2;
+				map_len = len - 1;
+			}
+			break;
+		}
+
+		p += 1 + len;
+	}
+
+	if (map)
+		ycbcr420_capability_map(cea, map, map_len, video, nvideo);
+
+	/* detailed timings fill the rest */
+	for (p = b + dtd_offset; p + 18 <= b + EDID_BLOCK_SIZE - 1 &&
+	     (p[0] || p[1]); p += 18) {
+		if (cea->ndtd < G_N_ELEMENTS(cea->dtds))
+			edid_timing_decode(p, &cea->dtds[cea->ndtd++]);
+	}
+}
+
+/*
+ * Decode all CEA-861 extension blocks of a complete EDID. Returns -1 if
+ * there are none.
+ */
+int edid_cea_decode(const unsigned char *edid, unsigned long length,
+		    struct edid_cea *cea)
+{
+	unsigned long offset;
+	int found = 0;
+
+	memset(cea, 0, sizeof(*cea));
+
+	for (offset = EDID_BLOCK_SIZE; offset + EDID_BLOCK_SIZE <= length;
+	     offset += EDID_BLOCK_SIZE) {
+		if (edid[offset] != CEA_EXTENSION_TAG)
+			continue;
+
+		cea_block_decode(cea, edid + offset);
+		found = 1;
+	}
+
+	return found ? 0 : -1;
+}
+
+/* human readable, g_free() the result */
+char *cea_summary(const struct edid_cea *cea)
+{
+	GString *s = g_string_new(cea->hdmi ? "HDMI" : "CEA-861");
+	int k, n = 0;
+
+	if (cea->max_tmds)
+		g_string_append_printf(s, ", max TMDS %u MHz",
+				       cea->max_tmds / 1000);
+	if (cea->max_tmds_hf)
+		g_string_append_printf(s, ", HF max TMDS %u MHz",
+				       cea->max_tmds_hf / 1000);
+
+	for (k = 0; k < cea->nsvd; ++k) {
+		const struct cea_svd *svd = &cea->svds[k];
+
+		if (!svd->ycbcr420)
+			continue;
+		g_string_append_printf(s, "%s %u%s",
+				       n++ ? "," : "\nYCbCr 4:2:0:", svd->vic,
+				       svd->ycbcr420 == CEA_YCBCR420_ONLY ?
+				       " (only)" : "");
+	}
+
+	return g_string_free(s, FALSE);
+}
@@ -0,0 +1,107 @@
+/*
+ * clone.c
+ *
+ * Clone mode finder: the timings a set of outputs can all be driven
+ * with, found by intersecting the mode bitsets of the outputs in the
+ * snapshot, best first.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+static const struct resources *sort_res;
+
+/* largest area first, then highest refresh, then widest */
+static int clone_cmp(const void *a, const void *b)
+{
+	const XRRModeInfo *ma = &sort_res->modes[*(const int *)a];
+	const XRRModeInfo *mb = &sort_res->modes[*(const int *)b];
+	guint64 a_area = (guint64)ma->width * ma->height;
+	guint64 b_area = (guint64)mb->width * mb->height;
+	double a_refresh = sort_res->table.refresh[*(const int *)a];
+	double b_refresh = sort_res->table.refresh[*(const int *)b];
+
+	if (a_area != b_area)
+		return a_area > b_area ? -1 : 1;
+	if (a_refresh != b_refresh)
+		return a_refresh > b_refresh ? -1 : 1;
+	if (ma->width != mb->width)
+		return ma->width > mb->width ? -1 : 1;
+
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Timings all of outputs list, as indices of the first snapshot mode
+ * with each timing, ranked by clone_cmp(). Outputs not in res are
+ * ignored. Free the result with g_array_free().
+ */
+GArray *clone_modes(const struct resources *res, const RROutput *outputs,
+		    int noutput)
+{
+	int nwords = MODE_BITS_WORDS(res->nmode);
+	gulong *common = g_new(gulong, nwords);
+	GArray *modes = g_array_new(FALSE, FALSE, sizeof(int));
+	int k, w, found = 0;
+
+	memset(common, 0xff, nwords * sizeof(gulong));
+	for (k = 0; k < noutput; ++k) {
+		struct output_info *output_info =
+		    resources_find_output(res, outputs[k]);
+
+		if (!output_info)
+			continue;
+		for (w = 0; w < nwords; ++w)
+			common[w] &= output_info->mode_bits[w];
+		found++;
+	}
+
+	for (w = 0; found && w < nwords; ++w) {
+		gint bit = -1;
+
+		while ((bit = g_bit_nth_lsf(common[w], bit)) >= 0) {
+			int index = w * MODE_BITS_PER_WORD + bit;
+
+			g_array_append_val(modes, index);
+		}
+	}
+	g_free(common);
+
+	sort_res = res;
+	qsort(modes->data, modes->len, sizeof(int), clone_cmp);
+	sort_res = NULL;
+
+	return modes;
+}
+
+/* the mode output_info lists with the timing of snapshot mode index */
+RRMode clone_mode_for(const struct resources *res,
+		      const struct output_info *output_info, int index)
+{
+	int k;
+
+	for (k = 0; k < output_info->nmode; ++k) {
+		XRRModeInfo *mode_info =
+		    resources_find_mode(res, output_info->modes[k]);
+		int other;
+
+		if (!mode_info)
+			continue;
+		other = resources_mode_index(res, mode_info);
+		if (res->table.timing[other] == index)
+			return mode_info->id;
+	}
+
+	return None;
+}
@@ -0,0 +1,222 @@
+/*
+ * displayid.c
+ *
+ * DisplayID 1.3 and 2.0 sections in EDID extension blocks: Type I and
+ * Type VII detailed timings and the tiled display topology. The walker
+ * hands out one data block at a time straight from the EDID buffer.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+#define DISPLAYID_EXTENSION_TAG 0x70
+
+/* data block tags, 1.x and 2.0 use distinct ranges */
+#define DISPLAYID_TYPE_I_TIMING 0x03
+#define DISPLAYID_TILED_DISPLAY 0x12
+#define DISPLAYID_TYPE_VII_TIMING 0x22
+#define DISPLAYID_TILED_DISPLAY_2 0x28
+
+#define DISPLAYID_TIMING_SIZE 20
+/* up to the first eight bytes of the topology ID */
+#define DISPLAYID_TILE_SIZE 21
+
+/* the section header follows the extension tag */
+#define SECTION_HEADER 5
+
+void displayid_iter_init(struct displayid_iter *iter,
+			 const unsigned char *edid, unsigned long length)
+{
+	memset(iter, 0, sizeof(*iter));
+	iter->edid = edid;
+	iter->length = length;
+}
+
+/* move to the next extension block holding a DisplayID section */
+static int section_next(struct displayid_iter *iter)
+{
+	while ((iter->block + 2) * EDID_BLOCK_SIZE <= iter->length) {
+		const unsigned char *b;
+		int bytes;
+
+		iter->block++;
+		b = iter->edid + iter->block * EDID_BLOCK_SIZE;
+		if (b[0] != DISPLAYID_EXTENSION_TAG)
+			continue;
+
+		/* the section has to fit in front of the block checksum */
+		bytes = b[2];
+		if (SECTION_HEADER + bytes > EDID_BLOCK_SIZE - 1)
+			bytes = EDID_BLOCK_SIZE - 1 - SECTION_HEADER;
+
+		iter->version = b[1];
+		iter->offset = SECTION_HEADER;
+		iter->end = SECTION_HEADER + bytes;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the payload of the next data block and its tag and length,
+ * or NULL at the end of the EDID. The payload points into the EDID.
+ */
+const unsigned char *displayid_iter_next(struct displayid_iter *iter,
+					 int *tag, int *len)
+{
+	for (;;) {
+		const unsigned char *b;
+
+		if (iter->offset + 3 > iter->end && !section_next(iter))
+			return NULL;
+		if (iter->offset + 3 > iter->end)
+			continue;
+
+		b = iter->edid + iter->block * EDID_BLOCK_SIZE + iter->offset;
+
+		/* a zero tag is padding up to the end of the section */
+		if (!b[0] || iter->offset + 3 + b[2] > iter->end) {
+			iter->offset = iter->end;
+			continue;
+		}
+
+		*tag = b[0];
+		*len = b[2];
+		iter->offset += 3 + b[2];
+
+		return b + 3;
+	}
+}
+
+/* Type I counts the clock in 10 kHz, Type VII in 1 kHz */
+static void timing_decode(const unsigned char *p, unsigned int unit,
+			  struct displayid_timing *t)
+{
+	t->pixclock = ((p[0] | p[1] << 8 | p[2] << 16) + 1) * unit;
+	t->preferred = !!(p[3] & 0x80);
+	t->interlaced = !!(p[3] & 0x10);
+	t->hactive = (p[4] | p[5] << 8) + 1;
+	t->hblank = (p[6] | p[7] << 8) + 1;
+	t->hsync_offset = (p[8] | (p[9] & 0x7f) << 8) + 1;
+	t->hsync_positive = !!(p[9] & 0x80);
+	t->hsync_width = (p[10] | p[11] << 8) + 1;
+	t->vactive = (p[12] | p[13] << 8) + 1;
+	t->vblank = (p[14] | p[15] << 8) + 1;
+	t->vsync_offset = (p[16] | (p[17] & 0x7f) << 8) + 1;
+	t->vsync_positive = !!(p[17] & 0x80);
+	t->vsync_width = (p[18] | p[19] << 8) + 1;
+}
+
+static void timings_decode(struct edid_displayid *did, const unsigned char *p,
+			   int len, unsigned int unit)
+{
+	for (; len >= DISPLAYID_TIMING_SIZE && did->ntiming <
+	     G_N_ELEMENTS(did->timings); len -= DISPLAYID_TIMING_SIZE,
+	     p += DISPLAYID_TIMING_SIZE)
+		timing_decode(p, unit, &did->timings[did->ntiming++]);
+}
+
+static void tile_decode(struct edid_displayid *did, const unsigned char *p,
+			int len)
+{
+	struct displayid_tile *tile = &did->tile;
+
+	if (len < DISPLAYID_TILE_SIZE)
+		return;
+
+	/* counts and locations split into low nibbles and high bits */
+	tile->single_enclosure = !!(p[0] & 0x80);
+	tile->num_h = ((p[1] >> 4) | ((p[3] >> 2) & 0x30)) + 1;
+	tile->num_v = ((p[1] & 0x0f) | (p[3] & 0x30)) + 1;
+	tile->h_loc = (p[2] >> 4) | ((p[3] >> 2) & 0x03) << 4;
+	tile->v_loc = (p[2] & 0x0f) | (p[3] & 0x03) << 4;
+	tile->width = (p[4] | p[5] << 8) + 1;
+	tile->height = (p[6] | p[7] << 8) + 1;
+	memcpy(tile->topology_id, p + 13, sizeof(tile->topology_id));
+	did->has_tile = 1;
+}
+
+/*
+ * Decode the DisplayID sections of a complete EDID. Returns -1 if there
+ * are none.
+ */
+int edid_displayid_decode(const unsigned char *edid, unsigned long length,
+			  struct edid_displayid *did)
+{
+	struct displayid_iter iter;
+	const unsigned char *p;
+	int tag, len;
+
+	memset(did, 0, sizeof(*did));
+
+	displayid_iter_init(&iter, edid, length);
+	while ((p = displayid_iter_next(&iter, &tag, &len))) {
+		did->version = iter.version;
+
+		switch (tag) {
+		case DISPLAYID_TYPE_I_TIMING:
+			timings_decode(did, p, len, 10);
+			break;
+		case DISPLAYID_TYPE_VII_TIMING:
+			timings_decode(did, p, len, 1);
+			break;
+		case DISPLAYID_TILED_DISPLAY:
+		case DISPLAYID_TILED_DISPLAY_2:
+			tile_decode(did, p, len);
+			break;
+		}
+	}
+
+	return did->version ? 0 : -1;
+}
+
+void displayid_timing_mode_info(const struct displayid_timing *t,
+				XRRModeInfo *mode_info)
+{
+	memset(mode_info, 0, sizeof(*mode_info));
+	mode_info->width = t->hactive;
+	mode_info->height = t->vactive;
+	mode_info->dotClock = t->pixclock * 1000UL;
+	mode_info->hSyncStart = t->hactive + t->hsync_offset;
+	mode_info->hSyncEnd = mode_info->hSyncStart + t->hsync_width;
+	mode_info->hTotal = t->hactive + t->hblank;
+	mode_info->vSyncStart = t->vactive + t->vsync_offset;
+	mode_info->vSyncEnd = mode_info->vSyncStart + t->vsync_width;
+	mode_info->vTotal = t->vactive + t->vblank;
+	mode_info->modeFlags =
+	    (t->hsync_positive ? RR_HSyncPositive : RR_HSyncNegative) |
+	    (t->vsync_positive ? RR_VSyncPositive : RR_VSyncNegative) |
+	    (t->interlaced ? RR_Interlace : 0);
+}
+
+/* human readable, g_free() the result */
+char *displayid_summary(const struct edid_displayid *did)
+{
+	GString *s = g_string_new(NULL);
+
+	g_string_append_printf(s, "DisplayID %d.%d", did->version >> 4,
+			       did->version & 0x0f);
+	if (did->has_tile) {
+		const struct displayid_tile *tile = &did->tile;
+
+		g_string_append_printf(s, ", tile %d,%d of %dx%d, %ux%u%s",
+				       tile->h_loc, tile->v_loc, tile->num_h,
+				       tile->num_v, tile->width, tile->height,
+				       tile->single_enclosure ?
+				       ", single enclosure" : "");
+	}
+
+	return g_string_free(s, FALSE);
+}
@@ -0,0 +1,245 @@
+/*
+ * drm-sysfs.c
+ *
+ * Backend for systems without X: outputs, EDIDs and mode lists are read
+ * from the DRM connectors in sysfs. Each connector costs three file
+ * reads (status, edid and modes) and nothing else.
+ *
+ * sysfs only lists mode names, so the modes carry their size but no
+ * timings, and there are no CRTCs.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+/* keep made up mode ids apart from the output ids */
+#define SYSFS_MODE_BASE 0x100
+
+/* connectors are named card<n>-<connector>, cards alone have no dash */
+static int connector_name(const char *name)
+{
+	return g_str_has_prefix(name, "card") && strchr(name, '-');
+}
+
+static gint name_cmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* contents of dir/name, NULL on error; the buffer goes to scratch */
+static char *file_read(GPtrArray *scratch, const char *dir, const char *name,
+		       gsize *length)
+{
+	char *path = g_build_filename(dir, name, NULL);
+	char *contents = NULL;
+
+	if (g_file_get_contents(path, &contents, length, NULL))
+		g_ptr_array_add(scratch, contents);
+	g_free(path);
+
+	return contents;
+}
+
+static Connection connection_parse(const char *status)
+{
+	if (!status)
+		return RR_UnknownConnection;
+	if (g_str_has_prefix(status, "connected"))
+		return RR_Connected;
+	if (g_str_has_prefix(status, "disconnected"))
+		return RR_Disconnected;
+
+	return RR_UnknownConnection;
+}
+
+/* one mode per line, the names are terminated in place */
+static void modes_parse(struct output_info *output_info, GArray *modes,
+			GPtrArray *scratch, char *text)
+{
+	GArray *ids = g_array_new(FALSE, FALSE, sizeof(RRMode));
+	char *line, *next;
+
+	for (line = text; line && *line; line = next) {
+		XRRModeInfo mode_info = { 0 };
+		unsigned int width, height;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+
+		if (sscanf(line, "%ux%u", &width, &height) != 2)
+			continue;
+
+		mode_info.id = SYSFS_MODE_BASE + modes->len;
+		mode_info.width = width;
+		mode_info.height = height;
+		mode_info.name = line;
+		mode_info.nameLength = strlen(line);
+		if (line[mode_info.nameLength - 1] == 'i')
+			mode_info.modeFlags = RR_Interlace;
+
+		g_array_append_val(modes, mode_info);
+		g_array_append_val(ids, mode_info.id);
+	}
+
+	output_info->nmode = ids->len;
+	/* the kernel sorts the preferred mode first */
+	output_info->npreferred = ids->len ? 1 : 0;
+	output_info->modes = (RRMode *) g_array_free(ids, FALSE);
+	g_ptr_array_add(scratch, output_info->modes);
+}
+
+/*
+ * The connector name without its cardN- prefix, unless a connector of
+ * another card has the same one, then the prefix has to stay to tell
+ * them apart.
+ */
+static const char *connector_output_name(GPtrArray *names, int k)
+{
+	const char *name = strchr(g_ptr_array_index(names, k), '-') + 1;
+	int n;
+
+	for (n = 0; n < names->len; ++n) {
+		const char *other = g_ptr_array_index(names, n);
+
+		if (n != k && !strcmp(strchr(other, '-') + 1, name))
+			return g_ptr_array_index(names, k);
+	}
+
+	return name;
+}
+
+/*
+ * Snapshot of the DRM connectors below root, usually /sys/class/drm. A
+ * copy of that tree works just as well, for testing. Returns NULL if
+ * root cannot be read.
+ */
+struct resources *resources_get_sysfs(const char *root)
+{
+	struct resources draft = { 0 };
+	struct resources *res;
+	GPtrArray *scratch = g_ptr_array_new_with_free_func(g_free);
+	GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+	GArray *outputs = g_array_new(FALSE, TRUE, sizeof(struct output_info));
+	GArray *modes = g_array_new(FALSE, TRUE, sizeof(XRRModeInfo));
+	const char *name;
+	GDir *dir;
+	int k;
+
+	dir = g_dir_open(root, 0, NULL);
+	if (!dir) {
+		res = NULL;
+		goto out;
+	}
+	while ((name = g_dir_read_name(dir))) {
+		if (connector_name(name))
+			g_ptr_array_add(names, g_strdup(name));
+	}
+	g_dir_close(dir);
+	g_ptr_array_sort(names, name_cmp);
+
+	for (k = 0; k < names->len; ++k) {
+		const char *connector = g_ptr_array_index(names, k);
+		char *path = g_build_filename(root, connector, NULL);
+		struct output_info output_info = { 0 };
+		gsize length;
+		char *text;
+
+		output_info.id = k + 1;
+		output_info.name = (char *)connector_output_name(names, k);
+		output_info.nameLen = strlen(output_info.name);
+
+		output_info.connection =
+		    connection_parse(file_read(scratch, path, "status",
+					       &length));
+
+		text = file_read(scratch, path, "edid", &length);
+		if (text && length) {
+			output_info.edid = (unsigned char *)text;
+			output_info.edid_length = length;
+		}
+
+		text = file_read(scratch, path, "modes", &length);
+		modes_parse(&output_info, modes, scratch, text);
+
+		g_array_append_val(outputs, output_info);
+		g_free(path);
+	}
+
+	draft.noutput = outputs->len;
+	draft.outputs = (struct output_info *)outputs->data;
+	draft.nmode = modes->len;
+	draft.modes = (XRRModeInfo *) modes->data;
+	res = resources_freeze(&draft);
+
+out:
+	g_array_free(modes, TRUE);
+	g_array_free(outputs, TRUE);
+	g_ptr_array_free(names, TRUE);
+	g_ptr_array_free(scratch, TRUE);
+
+	return res;
+}
+
+static const char *connection_name(Connection connection)
+{
+	switch (connection) {
+	case RR_Connected:
+		return "connected";
+	case RR_Disconnected:
+		return "disconnected";
+	default:
+		return "unknown";
+	}
+}
+
+/*
+ * Print the connectors below root, one line each: name, status, monitor
+ * and modes, preferred first. Returns the process exit status.
+ */
+int drm_sysfs_list(const char *root)
+{
+	struct resources *res = resources_get_sysfs(root);
+	int k, n;
+
+	if (!res) {
+		fprintf(stderr, "cannot read %s\n", root);
+		return 1;
+	}
+
+	for (k = 0; k < res->noutput; ++k) {
+		struct output_info *output_info = &res->outputs[k];
+		struct edid_info info;
+		char name[14] = "";
+
+		if (output_info->edid &&
+		    !edid_decode(output_info->edid, output_info->edid_length,
+				 &info))
+			edid_string_copy(&info.name, name, sizeof(name));
+
+		printf("%s\t%s\t%s\t", output_info->name,
+		       connection_name(output_info->connection), name);
+		for (n = 0; n < output_info->nmode; ++n) {
+			XRRModeInfo *mode_info =
+			    resources_find_mode(res, output_info->modes[n]);
+
+			printf("%s%s", n ? " " : "", mode_info->name);
+		}
+		putchar('\n');
+	}
+
+	resources_free(res);
+
+	return 0;
+}
@@ -0,0 +1,407 @@
+/*
+ * edid.c
+ *
+ * EDID base block decoder. The block is walked once, the display
+ * descriptors are dispatched through a table by tag. Decoded strings
+ * point into the EDID itself, so the buffer has to outlive the result.
+ *
+ * Decoded EDIDs are interned by content, outputs showing identical
+ * monitors share one record.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+static const unsigned char edid_header[8] = {
+	0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00
+};
+
+/*
+ * Byte sum of one 128 byte block, zero for a valid block. SSE2 sums 16
+ * bytes per instruction; elsewhere bytes are summed in 16 bit lanes of
+ * 64 bit words, which cannot overflow for a single block.
+ */
+unsigned char edid_block_checksum(const unsigned char *block)
+{
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	int k;
+
+	for (k = 0; k < EDID_BLOCK_SIZE; k += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(block + k));
+
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+	}
+
+	return (_mm_cvtsi128_si32(acc) +
+		_mm_cvtsi128_si32(_mm_srli_si128(acc, 8))) & 0xff;
+#else
+	const guint64 mask = G_GUINT64_CONSTANT(0x00ff00ff00ff00ff);
+	guint64 lanes = 0;
+	guint64 w;
+	int k;
+
+	for (k = 0; k < EDID_BLOCK_SIZE; k += 8) {
+		memcpy(&w, block + k, 8);
+		lanes += (w & mask) + ((w >> 8) & mask);
+	}
+
+	/* add up the four lanes in the top one */
+	return (lanes * G_GUINT64_CONSTANT(0x0001000100010001)) >> 48 & 0xff;
+#endif
+}
+
+/* 18 byte detailed timing descriptor, also used by CEA and DisplayID */
+void edid_timing_decode(const unsigned char *d, struct edid_timing *t)
+{
+	t->pixclock = (d[0] | d[1] << 8) * 10;
+	t->hactive = d[2] | (d[4] & 0xf0) << 4;
+	t->hblank = d[3] | (d[4] & 0x0f) << 8;
+	t->vactive = d[5] | (d[7] & 0xf0) << 4;
+	t->vblank = d[6] | (d[7] & 0x0f) << 8;
+	t->hsync_offset = d[8] | (d[11] & 0xc0) << 2;
+	t->hsync_width = d[9] | (d[11] & 0x30) << 4;
+	t->vsync_offset = (d[10] >> 4) | (d[11] & 0x0c) << 2;
+	t->vsync_width = (d[10] & 0x0f) | (d[11] & 0x03) << 4;
+	t->width_mm = d[12] | (d[14] & 0xf0) << 4;
+	t->height_mm = d[13] | (d[14] & 0x0f) << 8;
+	t->flags = d[17];
+}
+
+/* descriptor text ends at a line feed and is padded with spaces */
+static void string_decode(const unsigned char *d, struct edid_string *s)
+{
+	int len = 0;
+
+	while (len < 13 && d[5 + len] != 0x0a)
+		len++;
+	while (len && d[5 + len - 1] == ' ')
+		len--;
+
+	s->data = (const char *)d + 5;
+	s->len = len;
+}
+
+static void name_decode(const unsigned char *d, struct edid_info *info)
+{
+	string_decode(d, &info->name);
+}
+
+static void serial_decode(const unsigned char *d, struct edid_info *info)
+{
+	string_decode(d, &info->serial_string);
+}
+
+static void text_decode(const unsigned char *d, struct edid_info *info)
+{
+	string_decode(d, &info->text);
+}
+
+static void range_decode(const unsigned char *d, struct edid_info *info)
+{
+	struct edid_range *range = &info->range;
+	unsigned char offsets = d[4];
+
+	/* EDID 1.4 adds 255 to a limit if its offset flag is set */
+	range->min_vfreq = d[5] + ((offsets & 0x03) == 0x03 ? 255 : 0);
+	range->max_vfreq = d[6] + (offsets & 0x02 ? 255 : 0);
+	range->min_hfreq = d[7] + ((offsets & 0x0c) == 0x0c ? 255 : 0);
+	range->max_hfreq = d[8] + (offsets & 0x08 ? 255 : 0);
+	range->max_pixclock = d[9] * 10000;
+	info->has_range = 1;
+}
+
+static const struct {
+	unsigned char tag;
+	void (*decode)(const unsigned char *d, struct edid_info *info);
+} descriptor_table[] = {
+	{ 0xff, serial_decode },
+	{ 0xfe, text_decode },
+	{ 0xfd, range_decode },
+	{ 0xfc, name_decode },
+};
+
+static void descriptor_decode(const unsigned char *d, struct edid_info *info)
+{
+	unsigned int k;
+
+	/* a non-zero pixel clock makes it a detailed timing */
+	if (d[0] || d[1]) {
+		edid_timing_decode(d, &info->timings[info->ntiming++]);
+		return;
+	}
+
+	for (k = 0; k < G_N_ELEMENTS(descriptor_table); ++k) {
+		if (descriptor_table[k].tag == d[3]) {
+			descriptor_table[k].decode(d, info);
+			return;
+		}
+	}
+}
+
+/*
+ * Decode the base block of edid into info. Returns -1 if there is no
+ * valid header; a bad checksum is only reported in info.
+ */
+int edid_decode(const unsigned char *edid, unsigned long length,
+		struct edid_info *info)
+{
+	int k;
+
+	memset(info, 0, sizeof(*info));
+
+	if (length < EDID_BLOCK_SIZE || memcmp(edid, edid_header, 8))
+		return -1;
+
+	info->checksum_ok = !edid_block_checksum(edid);
+
+	/* three letters of five bits each, 1 is 'A' */
+	info->vendor[0] = '@' + ((edid[8] >> 2) & 0x1f);
+	info->vendor[1] = '@' + ((edid[8] & 0x03) << 3 | edid[9] >> 5);
+	info->vendor[2] = '@' + (edid[9] & 0x1f);
+	info->product = edid[10] | edid[11] << 8;
+	info->serial = edid[12] | edid[13] << 8 | edid[14] << 16 |
+	    (guint32)edid[15] << 24;
+	info->week = edid[16];
+	info->year = edid[17] + 1990;
+	info->version = edid[18];
+	info->revision = edid[19];
+	info->width_cm = edid[21];
+	info->height_cm = edid[22];
+
+	for (k = 0x36; k < 0x7e; k += 18)
+		descriptor_decode(&edid[k], info);
+
+	info->nextension = edid[0x7e];
+
+	return 0;
+}
+
+/* copy s NUL terminated into buf of size bytes */
+void edid_string_copy(const struct edid_string *s, char *buf, size_t size)
+{
+	size_t len = MIN(s->len, size - 1);
+
+	memcpy(buf, s->data, len);
+	buf[len] = 0;
+}
+
+/*
+ * Interning. Records are looked up by a hash over the complete EDID and
+ * live as long as some output refers to them. Main thread only.
+ */
+static GHashTable *records;	/* struct edid_record -> itself */
+
+static guint edid_hash(const unsigned char *data, gsize size)
+{
+	guint64 h = size * G_GUINT64_CONSTANT(0x9e3779b97f4a7c15);
+	guint64 w;
+	gsize k;
+
+	for (k = 0; k + 8 <= size; k += 8) {
+		memcpy(&w, data + k, 8);
+		h = (h ^ w) * G_GUINT64_CONSTANT(0xff51afd7ed558ccd);
+		h ^= h >> 32;
+	}
+	for (; k < size; ++k)
+		h = (h ^ data[k]) * G_GUINT64_CONSTANT(0x100000001b3);
+
+	return (guint)(h ^ h >> 32);
+}
+
+static guint record_hash(gconstpointer key)
+{
+	return ((const struct edid_record *)key)->hash;
+}
+
+static gboolean record_equal(gconstpointer a, gconstpointer b)
+{
+	const struct edid_record *ra = a;
+	const struct edid_record *rb = b;
+
+	return ra->hash == rb->hash && g_bytes_equal(ra->bytes, rb->bytes);
+}
+
+/* takes the id from mode_info, the name is made up here */
+static void record_mode_add(struct edid_record *record,
+			    XRRModeInfo *mode_info)
+{
+	int k;
+
+	/* a mode may be listed more than once */
+	for (k = 0; k < record->modes->len; ++k) {
+		if (g_array_index(record->modes, XRRModeInfo, k).id ==
+		    mode_info->id)
+			return;
+	}
+
+	mode_info->name = g_strdup_printf("%ux%u%s", mode_info->width,
+					  mode_info->height,
+					  mode_info->modeFlags & RR_Interlace ?
+					  "i" : "");
+	mode_info->nameLength = strlen(mode_info->name);
+	g_array_append_val(record->modes, *mode_info);
+}
+
+static void record_decode(struct edid_record *record)
+{
+	const unsigned char *data;
+	GString *summary = g_string_new(NULL);
+	XRRModeInfo mode_info;
+	gsize size;
+	int k;
+
+	data = g_bytes_get_data(record->bytes, &size);
+
+	if (edid_decode(data, size, &record->info)) {
+		g_warning("edid header incorrect. Probably not an edid\n");
+	} else {
+		if (!record->info.checksum_ok)
+			g_warning("edid checksum failed\n");
+		edid_string_copy(&record->info.name, record->name,
+				 sizeof(record->name));
+	}
+
+	record->has_cea = !edid_cea_decode(data, size, &record->cea);
+	if (record->has_cea) {
+		char *text = cea_summary(&record->cea);
+
+		g_string_append(summary, text);
+		g_free(text);
+
+		for (k = 0; k < record->cea.nsvd; ++k) {
+			unsigned int vic = record->cea.svds[k].vic;
+
+			if (!cea_vic_get(vic))
+				continue;
+
+			cea_vic_mode_info(cea_vic_get(vic), &mode_info);
+			mode_info.id = ADVERTISED_XID | vic;
+			record_mode_add(record, &mode_info);
+		}
+	}
+
+	record->has_displayid = !edid_displayid_decode(data, size,
+						       &record->displayid);
+	if (record->has_displayid) {
+		char *text = displayid_summary(&record->displayid);
+
+		if (summary->len)
+			g_string_append_c(summary, '\n');
+		g_string_append(summary, text);
+		g_free(text);
+
+		for (k = 0; k < record->displayid.ntiming; ++k) {
+			displayid_timing_mode_info(&record->displayid.timings[k],
+						   &mode_info);
+			mode_info.id = ADVERTISED_XID | ADVERTISED_DISPLAYID | k;
+			record_mode_add(record, &mode_info);
+		}
+	}
+
+	if (summary->len)
+		record->summary = g_string_free(summary, FALSE);
+	else
+		g_string_free(summary, TRUE);
+}
+
+/*
+ * The decoded record for edid, shared with every other holder of the
+ * same content. Returns a new reference.
+ */
+struct edid_record *edid_intern(GBytes *edid)
+{
+	struct edid_record key;
+	struct edid_record *record;
+	gsize size;
+	const unsigned char *data = g_bytes_get_data(edid, &size);
+
+	if (!records)
+		records = g_hash_table_new(record_hash, record_equal);
+
+	key.bytes = edid;
+	key.hash = edid_hash(data, size);
+	record = g_hash_table_lookup(records, &key);
+	if (record) {
+		record->ref++;
+		return record;
+	}
+
+	record = g_new0(struct edid_record, 1);
+	record->ref = 1;
+	record->bytes = g_bytes_ref(edid);
+	record->hash = key.hash;
+	record->modes = g_array_new(FALSE, FALSE, sizeof(XRRModeInfo));
+	record_decode(record);
+	g_hash_table_add(records, record);
+
+	return record;
+}
+
+/*
+ * Whether the monitor of record can take mode_info at all, going by the
+ * range limits descriptor and, if tmds is set because the mode goes out
+ * as TMDS, the HDMI TMDS limits. Those only bound the sink's HDMI input,
+ * a DisplayPort output feeding it is not held to them. Returns the limit
+ * the mode is beyond, NULL if it is within all that are given. Rates in
+ * the descriptor are whole numbers, so a bit of rounding is allowed.
+ */
+const char *edid_mode_check(const struct edid_record *record,
+			    const XRRModeInfo *mode_info, gboolean tmds)
+{
+	const struct edid_range *range = &record->info.range;
+	unsigned int pixclock = mode_info->dotClock / 1000;
+	unsigned int max_tmds;
+	struct mode_metrics m;
+
+	if (record->info.has_range) {
+		mode_metrics_get(NULL, mode_info, &m);
+
+		if (m.refresh < range->min_vfreq - 0.5 ||
+		    m.refresh > range->max_vfreq + 0.5)
+			return "refresh out of range";
+		if (m.hfreq / 1000 < range->min_hfreq - 0.5 ||
+		    m.hfreq / 1000 > range->max_hfreq + 0.5)
+			return "line rate out of range";
+		if (range->max_pixclock && pixclock > range->max_pixclock)
+			return "pixel clock too high";
+	}
+
+	/* 8 bpc, the TMDS clock is the pixel clock */
+	max_tmds = MAX(record->cea.max_tmds, record->cea.max_tmds_hf);
+	if (tmds && record->has_cea && max_tmds && pixclock > max_tmds)
+		return "TMDS clock too high";
+
+	return NULL;
+}
+
+void edid_record_unref(struct edid_record *record)
+{
+	int k;
+
+	if (--record->ref)
+		return;
+
+	g_hash_table_remove(records, record);
+
+	for (k = 0; k < record->modes->len; ++k)
+		g_free(g_array_index(record->modes, XRRModeInfo, k).name);
+	g_array_free(record->modes, TRUE);
+	g_free(record->summary);
+	g_bytes_unref(record->bytes);
+	g_free(record);
+}
@@ -16,304 +16,1702 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <gtk/gtk.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/Xrandr.h>
+#include <X11/Xlib-xcb.h>
 
-static XRRScreenResources *res;
+#include "gresolutions.h"
+#include "mode-model.h"
+
+static struct resources *res;
 static Display *dpy;
+static xcb_connection_t *xcb;
 static Window root;
 static int screen;
+static GtkWidget *notebook;
+static GHashTable *tabs;	/* RROutput -> struct tab */
+static GSimpleAction *probe_action;
+static GSimpleAction *sweep_action;
+
+/* RandR notifications are collected for this long before refreshing */
+#define REFRESH_DELAY_MS 100
+
+static int rr_event_base;
+static GHashTable *dirty_outputs;
+static GHashTable *dirty_crtcs;
+static gboolean dirty_screen;
+static guint refresh_id;
+
+static gboolean opt_probe;
+static char *opt_latency_dump;
+static char *opt_sweep;
+static char *opt_sweep_results;
+static char **opt_inspect;
+static gboolean opt_drm;
+static char *opt_sysfs_root = "/sys/class/drm";
+static char *opt_link;
+static char *opt_link_config;
+static char **opt_modeline;
+static gboolean opt_force;
 
-enum {
-	XID_COLUMN,
-	XID_STRING_COLUMN,
-	NAME_COLUMN,
-	REFRESH_COLUMN,
-	PIXCLOCK_COLUMN,
-	PREFERRED_COLUMN,
-	N_COLUMNS
+/* modes that do not fit through it are not applied */
+static const struct link_profile *active_link;
+
+struct tab {
+	RROutput output;
+	GtkWidget *page;	/* scrolled window around tree */
+	GtkWidget *tree;
+	GtkWidget *label;
+	GtkWidget *spinner;
+	gboolean pending;
+	/* the last mode switch, until its RRCrtcChangeNotify comes in */
+	struct latency *latency;
+	gint64 apply_start;
+	RRCrtc apply_crtc;
+	RRMode apply_mode;
+	gboolean notify_pending;
+	struct edid_record *edid;
+	/* HDMI or DVI output, held to the sink's TMDS limits */
+	gboolean tmds;
+	/* FALSE while edid is decoded from the base block alone */
+	gboolean edid_complete;
+	/* modes CEA or DisplayID advertise that the output does not expose */
+	GArray *advertised;	/* XRRModeInfo, names owned by edid */
 };
 
-static unsigned char *output_edid_get(RROutput output, unsigned long *length)
-{
-	Atom edid = None, type = None;
-	unsigned char *prop;
-	int format = 0;
-	unsigned long nitems = 0, bytes = 0;
-
-	/* try to get the edid atom */
-	if (!(edid = XInternAtom(dpy, RR_PROPERTY_RANDR_EDID, False)))
-		return NULL;
-
-	/* get the output property
-	 * 
-	 * NB: Returns 0 on success */
-	if (!XRRGetOutputProperty
-	    (dpy, output, edid, 0, 128, False, False, AnyPropertyType,
-	     &type, &format, &nitems, &bytes, &prop)) {
-		if ((type == XA_INTEGER) && (nitems >= 1) && (format == 8)) {
-			unsigned char *ret = NULL;
-
-			if ((ret = malloc(nitems * sizeof(unsigned char)))) {
-				if (length)
-					*length = nitems;
-				memcpy(ret, prop,
-				       (nitems * sizeof(unsigned char)));
-				return ret;
-			}
-		}
+static const GOptionEntry options[] = {
+	{ "probe", 'p', 0, G_OPTION_ARG_NONE, &opt_probe,
+	  "Probe hardware on startup instead of using cached resources",
+	  NULL },
+	{ "latency-dump", 'l', 0, G_OPTION_ARG_FILENAME, &opt_latency_dump,
+	  "Write mode switch latency percentiles as JSON on exit, - for stdout",
+	  "FILE" },
+	{ "sweep", 's', 0, G_OPTION_ARG_STRING, &opt_sweep,
+	  "Apply every mode of OUTPUT in turn, write the results and quit",
+	  "OUTPUT" },
+	{ "sweep-results", 'r', 0, G_OPTION_ARG_FILENAME, &opt_sweep_results,
+	  "Where to write sweep results, JSON if FILE ends in .json, "
+	  "CSV otherwise; default is CSV on stdout", "FILE" },
+	{ "inspect", 'i', 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_inspect,
+	  "Validate the raw EDID dumps in PATH without an X server, "
+	  "may be given more than once", "PATH" },
+	{ "drm", 'd', 0, G_OPTION_ARG_NONE, &opt_drm,
+	  "List the DRM connectors from sysfs without an X server", NULL },
+	{ "sysfs-root", 0, 0, G_OPTION_ARG_FILENAME, &opt_sysfs_root,
+	  "Read DRM connectors below DIR instead of /sys/class/drm", "DIR" },
+	{ "link", 0, 0, G_OPTION_ARG_STRING, &opt_link,
+	  "Only apply modes that fit through link profile NAME", "NAME" },
+	{ "link-config", 0, 0, G_OPTION_ARG_FILENAME, &opt_link_config,
+	  "Read link profiles from FILE instead of "
+	  "~/.config/gresolutions/links.conf", "FILE" },
+	{ "force", 'f', 0, G_OPTION_ARG_NONE, &opt_force,
+	  "Sweep modes beyond the monitor's range limits as well", NULL },
+	{ "modeline", 'm', 0, G_OPTION_ARG_STRING_ARRAY, &opt_modeline,
+	  "Print the modeline for WIDTHxHEIGHT@REFRESH[:cvt|rb|rb2|gtf] and "
+	  "exit, may be given more than once", "SPEC" },
+	{ NULL }
+};
+
+static void tab_set_pending(struct tab *tab, gboolean pending)
+{
+	tab->pending = pending;
+	gtk_widget_set_sensitive(tab->tree, !pending);
+	gtk_widget_set_visible(tab->spinner, pending);
+	if (pending)
+		gtk_spinner_start(GTK_SPINNER(tab->spinner));
+	else
+		gtk_spinner_stop(GTK_SPINNER(tab->spinner));
+}
+
+static void tab_tooltip_update(struct tab *tab)
+{
+	char *summary = latency_summary(tab->latency);
+	char *text;
+
+	if (tab->edid && tab->edid->summary)
+		text = g_strdup_printf("%s\n\n%s", tab->edid->summary, summary);
+	else
+		text = g_strdup(summary);
+	gtk_widget_set_tooltip_text(gtk_widget_get_parent(tab->label), text);
+	g_free(text);
+	g_free(summary);
+}
+
+/*
+ * Why mode_info must not be applied to the output of tab, NULL if it
+ * may. Forcing overrides the monitor's limits but not the link's.
+ */
+static const char *mode_refusal(struct tab *tab, const XRRModeInfo *mode_info,
+				gboolean force)
+{
+	const char *range;
+
+	if (active_link && !link_fits(active_link, mode_info))
+		return "does not fit the link";
+
+	if (!force && tab && tab->edid) {
+		range = edid_mode_check(tab->edid, mode_info, tab->tmds);
+		if (range)
+			return range;
 	}
 
 	return NULL;
 }
 
-static int parseedid(unsigned char *edid, unsigned char *modelname) {
-	int i;
-	int j;
-	unsigned char sum = 0;
+static void apply_done(RROutput output, RRMode mode, int status,
+		       gboolean skipped, gint64 reply_time, gpointer user_data)
+{
+	struct tab *tab = g_hash_table_lookup(tabs, GUINT_TO_POINTER(output));
+
+	/* the output may have gone away in the meantime */
+	if (tab) {
+		tab_set_pending(tab, FALSE);
+		/* a skipped switch, like a failed one, has nothing to time */
+		if (!status && !skipped) {
+			histogram_record(&tab->latency->reply,
+					 reply_time - tab->apply_start);
+			tab_tooltip_update(tab);
+		} else {
+			tab->notify_pending = FALSE;
+		}
+	}
+
+	if (status)
+		g_warning("setting mode 0x%x on output 0x%x failed (%d)\n",
+			  (unsigned int)mode, (unsigned int)output, status);
+}
+
+void row_activated(GtkTreeView * tree_view,
+		   GtkTreePath * path,
+		   GtkTreeViewColumn * column, gpointer user_data)
+{
+	struct tab *tab = user_data;
+	struct output_info *output_info;
+	struct crtc_info *crtc_info;
+	XRRModeInfo *mode_info;
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+	GdkModifierType state;
+	gboolean force;
+
+	output_info = resources_find_output(res, tab->output);
+	if (!output_info || tab->pending)
+		return;
+
+	model = gtk_tree_view_get_model(tree_view);
+	if (gtk_tree_model_get_iter(model, &iter, path)) {
+		int xid;
+
+		gtk_tree_model_get(model, &iter, XID_COLUMN, &xid, -1);
+
+		/* the server does not know advertised only modes */
+		if (xid & ADVERTISED_XID)
+			return;
+
+		/* nothing to do for the mode that is already active */
+		crtc_info = resources_find_crtc(res, output_info->crtc);
+		if (crtc_info && crtc_info->mode == xid)
+			return;
+
+		mode_info = resources_find_mode(res, xid);
+		/* shift forces modes beyond the monitor's limits */
+		force = gtk_get_current_event_state(&state) &&
+		    state & GDK_SHIFT_MASK;
+		if (!mode_info || mode_refusal(tab, mode_info, force))
+			return;
+
+		tab_set_pending(tab, TRUE);
+		tab->apply_start = g_get_monotonic_time();
+		tab->apply_crtc = output_info->crtc;
+		tab->apply_mode = xid;
+		tab->notify_pending = TRUE;
+		apply_mode(output_info->id, xid, 0, apply_done, NULL);
+	}
+}
+
+static int output_shown(struct resources *res, struct output_info *output_info)
+{
+	if (output_info->connection == RR_Disconnected)
+		return 0;
+
+	if (!output_info->crtc)
+		return 0;
+
+	return resources_find_crtc(res, output_info->crtc) != NULL;
+}
+
+/*
+ * Top level row index of the mode xid in model, -1 if not found. Alias
+ * rows are searched as well, iter is set to the row that has xid.
+ */
+static int model_find_xid(GtkTreeModel *model, int xid, GtkTreeIter *iter)
+{
+	GtkTreeIter parent;
+	gboolean valid;
+	int index = 0;
+
+	for (valid = gtk_tree_model_get_iter_first(model, &parent); valid;
+	     valid = gtk_tree_model_iter_next(model, &parent), ++index) {
+		gboolean child_valid;
+		int row_xid;
+
+		*iter = parent;
+		gtk_tree_model_get(model, iter, XID_COLUMN, &row_xid, -1);
+		if (row_xid == xid)
+			return index;
 
-	//check the checksum
-	for (i = 0; i<128; i++) {
-		sum += edid[i];
+		for (child_valid = gtk_tree_model_iter_children(model, iter,
+								&parent);
+		     child_valid;
+		     child_valid = gtk_tree_model_iter_next(model, iter)) {
+			gtk_tree_model_get(model, iter, XID_COLUMN, &row_xid,
+					   -1);
+			if (row_xid == xid)
+				return index;
+		}
 	}
 
-	if (sum)
-		g_warning("edid checksum failed\n");
+	return -1;
+}
+
+static void xid_cell_data(GtkTreeViewColumn *column,
+			  GtkCellRenderer *renderer, GtkTreeModel *model,
+			  GtkTreeIter *iter, gpointer user_data)
+{
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(model), iter);
+	char text[16];
+
+	if (mode_info->id & ADVERTISED_XID)
+		snprintf(text, sizeof(text), "%s %u",
+			 mode_info->id & ADVERTISED_DISPLAYID ? "DID" : "VIC",
+			 (unsigned int)(mode_info->id & ADVERTISED_INDEX));
+	else
+		snprintf(text, sizeof(text), "0x%x",
+			 (unsigned int)mode_info->id);
+	g_object_set(G_OBJECT(renderer), "text", text, "sensitive",
+		     !(mode_info->id & ADVERTISED_XID), NULL);
+}
+
+static void name_cell_data(GtkTreeViewColumn *column,
+			   GtkCellRenderer *renderer, GtkTreeModel *model,
+			   GtkTreeIter *iter, gpointer user_data)
+{
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(model), iter);
+
+	g_object_set(G_OBJECT(renderer), "text", mode_info->name, "sensitive",
+		     !(mode_info->id & ADVERTISED_XID), NULL);
+}
+
+static void refresh_cell_data(GtkTreeViewColumn *column,
+			      GtkCellRenderer *renderer, GtkTreeModel *model,
+			      GtkTreeIter *iter, gpointer user_data)
+{
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(model), iter);
+	struct mode_metrics m;
+	char text[32];
+
+	mode_metrics_get(res, mode_info, &m);
+	snprintf(text, sizeof(text), "%6.2fHz", m.refresh);
+	g_object_set(G_OBJECT(renderer), "text", text, "sensitive",
+		     !(mode_info->id & ADVERTISED_XID), NULL);
+}
+
+static void pixclock_cell_data(GtkTreeViewColumn *column,
+			       GtkCellRenderer *renderer, GtkTreeModel *model,
+			       GtkTreeIter *iter, gpointer user_data)
+{
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(model), iter);
+	char text[32];
+
+	snprintf(text, sizeof(text), "%6.3fMHz",
+		 (double)mode_info->dotClock / 1000000.0);
+	g_object_set(G_OBJECT(renderer), "text", text, "sensitive",
+		     !(mode_info->id & ADVERTISED_XID), NULL);
+}
+
+static void hfreq_cell_data(GtkTreeViewColumn *column,
+			    GtkCellRenderer *renderer, GtkTreeModel *model,
+			    GtkTreeIter *iter, gpointer user_data)
+{
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(model), iter);
+	struct mode_metrics m;
+	char text[32];
+
+	mode_metrics_get(res, mode_info, &m);
+	snprintf(text, sizeof(text), "%6.2fkHz", m.hfreq / 1000.0);
+	g_object_set(G_OBJECT(renderer), "text", text, "sensitive",
+		     !(mode_info->id & ADVERTISED_XID), NULL);
+}
+
+static void blanking_cell_data(GtkTreeViewColumn *column,
+			       GtkCellRenderer *renderer, GtkTreeModel *model,
+			       GtkTreeIter *iter, gpointer user_data)
+{
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(model), iter);
+	struct mode_metrics m;
+	char text[32];
+
+	mode_metrics_get(res, mode_info, &m);
+	snprintf(text, sizeof(text), "%4.1f%%", m.blanking * 100.0);
+	g_object_set(G_OBJECT(renderer), "text", text, "sensitive",
+		     !(mode_info->id & ADVERTISED_XID), NULL);
+}
+
+/* uncompressed 24 bpp */
+static void bandwidth_cell_data(GtkTreeViewColumn *column,
+				GtkCellRenderer *renderer, GtkTreeModel *model,
+				GtkTreeIter *iter, gpointer user_data)
+{
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(model), iter);
+	struct mode_metrics m;
+	char text[32];
+
+	mode_metrics_get(res, mode_info, &m);
+	snprintf(text, sizeof(text), "%6.2fGbit/s", m.bandwidth / 1e9);
+	g_object_set(G_OBJECT(renderer), "text", text, "sensitive",
+		     !(mode_info->id & ADVERTISED_XID), NULL);
+}
+
+/* empty while no link profile is selected */
+static void fits_cell_data(GtkTreeViewColumn *column,
+			   GtkCellRenderer *renderer, GtkTreeModel *model,
+			   GtkTreeIter *iter, gpointer user_data)
+{
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(model), iter);
+	int fits = !active_link || link_fits(active_link, mode_info);
+	char text[32] = "";
+
+	if (active_link)
+		snprintf(text, sizeof(text), "%s %3.0f%%",
+			 fits ? "yes" : "no",
+			 link_load(active_link, mode_info->dotClock) * 100.0);
+	g_object_set(G_OBJECT(renderer), "text", text, "foreground-set",
+		     !fits, "sensitive", !(mode_info->id & ADVERTISED_XID),
+		     NULL);
+}
+
+/* empty without range limits, otherwise which one the mode is beyond */
+static void range_cell_data(GtkTreeViewColumn *column,
+			    GtkCellRenderer *renderer, GtkTreeModel *model,
+			    GtkTreeIter *iter, gpointer user_data)
+{
+	struct tab *tab = user_data;
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(model), iter);
+	const char *range = NULL;
+	const char *text = "";
 
-	//check header
-	for (i = 0; i < 8; i++) {
-		if (!(((i == 0 || i == 7) && edid[i] == 0x00) || (edid[i] == 0xff))) //0x00 0xff 0xff 0xff 0xff 0xff 0x00
-			g_warning("edid header incorrect. Probably not an edid\n");
+	if (tab->edid && (tab->edid->info.has_range || tab->edid->has_cea)) {
+		range = edid_mode_check(tab->edid, mode_info, tab->tmds);
+		text = range ? range : "ok";
 	}
+	g_object_set(G_OBJECT(renderer), "text", text, "foreground-set",
+		     range != NULL, "sensitive",
+		     !(mode_info->id & ADVERTISED_XID), NULL);
+}
+
+/*
+ * Fixed height mode needs fixed column widths, which are taken from the
+ * wider of the title and a sample of the column content.
+ */
+static void column_set_fixed_width(GtkTreeViewColumn *column,
+				   GtkWidget *tree, const char *sample)
+{
+	PangoLayout *layout;
+	int title_width, sample_width;
+
+	layout = gtk_widget_create_pango_layout(tree,
+						gtk_tree_view_column_get_title
+						(column));
+	pango_layout_get_pixel_size(layout, &title_width, NULL);
+	pango_layout_set_text(layout, sample, -1);
+	pango_layout_get_pixel_size(layout, &sample_width, NULL);
+	g_object_unref(layout);
+
+	gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_column_set_fixed_width(column,
+					     MAX(title_width,
+						 sample_width) + 16);
+}
+
+static GtkTreeViewColumn *column_new(GtkWidget *tree, const char *title,
+				     GtkCellRenderer *renderer,
+				     GtkTreeCellDataFunc cell_data,
+				     const char *sample)
+{
+	GtkTreeViewColumn *column = gtk_tree_view_column_new();
+
+	gtk_tree_view_column_set_title(column, title);
+	gtk_tree_view_column_pack_start(column, renderer, TRUE);
+	if (cell_data)
+		gtk_tree_view_column_set_cell_data_func(column, renderer,
+							cell_data, NULL, NULL);
+	column_set_fixed_width(column, tree, sample);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
+
+	return column;
+}
+
+static struct tab *tab_new(struct output_info *output_info)
+{
+	struct tab *tab = g_new0(struct tab, 1);
+	GtkWidget *tree;
+	GtkWidget *box;
+	GtkTreeViewColumn *column;
+	GtkCellRenderer *renderer;
+
+	tab->output = output_info->id;
+	tab->tmds = g_str_has_prefix(output_info->name, "HDMI") ||
+	    g_str_has_prefix(output_info->name, "DVI");
+	tab->advertised = g_array_new(FALSE, FALSE, sizeof(XRRModeInfo));
+
+	/* Create a view */
+	tree = gtk_tree_view_new();
+	g_signal_connect(tree, "row-activated", G_CALLBACK(row_activated),
+			 tab);
+
+	/*
+	 * only rows that are drawn get their text formatted, which needs
+	 * all rows to have the same height
+	 */
+	gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(tree), TRUE);
+
+	renderer = gtk_cell_renderer_text_new();
+	g_object_set(G_OBJECT(renderer), "foreground", "red", NULL);
+	column_new(tree, "XID", renderer, xid_cell_data, "0x00000000");
+
+	renderer = gtk_cell_renderer_toggle_new();
+	g_object_set(G_OBJECT(renderer), "radio", TRUE, NULL);
+	column = column_new(tree, "Preferred", renderer, NULL, "");
+	gtk_tree_view_column_add_attribute(column, renderer, "active",
+					   PREFERRED_COLUMN);
+
+	renderer = gtk_cell_renderer_text_new();
+	column_new(tree, "Mode", renderer, name_cell_data,
+		   "00000x00000_000.00i");
+	column_new(tree, "Refresh", renderer, refresh_cell_data,
+		   "000.00Hz");
+	column_new(tree, "Pixclock", renderer, pixclock_cell_data,
+		   "0000.000MHz");
+	column_new(tree, "HSync", renderer, hfreq_cell_data, "000.00kHz");
+	column_new(tree, "Blank", renderer, blanking_cell_data, "00.0%");
+	column_new(tree, "Rate", renderer, bandwidth_cell_data,
+		   "000.00Gbit/s");
+
+	renderer = gtk_cell_renderer_text_new();
+	g_object_set(G_OBJECT(renderer), "foreground", "red", NULL);
+	column_new(tree, "Fits", renderer, fits_cell_data, "yes 000%");
+	column = column_new(tree, "Range", renderer, NULL,
+			    "line rate out of range");
+	gtk_tree_view_column_set_cell_data_func(column, renderer,
+						range_cell_data, tab, NULL);
+
+	tab->tree = tree;
+	tab->page = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(tab->page),
+				       GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+	gtk_container_add(GTK_CONTAINER(tab->page), tree);
 
-	//Product Identification
-	/* Model Name: Only thing I do out of order of edid, to comply with X standards... */
-	for (i = 0x36; i < 0x7E; i += 0x12) { //read through descriptor blocks...
-		if (edid[i] == 0x00) { //not a timing descriptor
-			if (edid[i+3] == 0xfc) { //Model Name tag
-				for (j = 0; j < 13; j++) {
-					if (edid[i+5+j] == 0x0a)
-						modelname[j] = 0x00;
-					else
-						modelname[j] = edid[i+5+j];
+	/* the spinner shows while a mode switch is pending */
+	box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+	tab->label = gtk_label_new(NULL);
+	tab->spinner = gtk_spinner_new();
+	gtk_box_pack_start(GTK_BOX(box), tab->label, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(box), tab->spinner, FALSE, FALSE, 0);
+	gtk_widget_show(tab->label);
+	gtk_widget_show(box);
+	gtk_widget_set_no_show_all(tab->spinner, TRUE);
+
+	gtk_notebook_append_page(GTK_NOTEBOOK(notebook), tab->page, box);
+
+	return tab;
+}
+
+static void tab_free(struct tab *tab)
+{
+	g_array_free(tab->advertised, TRUE);
+	if (tab->edid)
+		edid_record_unref(tab->edid);
+	g_free(tab);
+}
+
+/* same size and scan, refresh within half a percent for the 1000/1001 rates */
+static int mode_exposed(struct output_info *output_info,
+			const XRRModeInfo *advertised)
+{
+	struct mode_metrics m;
+	double refresh;
+	int k;
+
+	mode_metrics_get(res, advertised, &m);
+	refresh = m.refresh;
+
+	for (k = 0; k < output_info->nmode; ++k) {
+		XRRModeInfo *mode_info =
+		    resources_find_mode(res, output_info->modes[k]);
+
+		if (!mode_info || mode_info->width != advertised->width ||
+		    mode_info->height != advertised->height ||
+		    (mode_info->modeFlags & RR_Interlace) !=
+		    (advertised->modeFlags & RR_Interlace))
+			continue;
+
+		mode_metrics_get(res, mode_info, &m);
+		if (fabs(m.refresh - refresh) < refresh * 0.005)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Shares the decoded EDID with all outputs showing the same monitor.
+ * The extension blocks cost round trips, they are only fetched if
+ * complete is set, otherwise what is at hand is decoded.
+ */
+static void tab_edid_update(struct tab *tab, struct output_info *output_info,
+			    gboolean complete)
+{
+	struct edid_record *record = NULL;
+	GBytes *edid;
+	int k;
+
+	if (complete)
+		edid = output_edid_get(xcb, res, output_info);
+	else
+		edid = output_edid_peek(output_info, &complete);
+	tab->edid_complete = complete;
+	if (edid) {
+		record = edid_intern(edid);
+		g_bytes_unref(edid);
+	}
+
+	/* only dropped now, so an unchanged EDID is not decoded again */
+	if (tab->edid)
+		edid_record_unref(tab->edid);
+	tab->edid = record;
+
+	g_array_set_size(tab->advertised, 0);
+	if (!record)
+		return;
+
+	for (k = 0; k < record->modes->len; ++k) {
+		XRRModeInfo *mode_info =
+		    &g_array_index(record->modes, XRRModeInfo, k);
+
+		if (!mode_exposed(output_info, mode_info))
+			g_array_append_val(tab->advertised, *mode_info);
+	}
+}
+
+static void tab_model_update(ModeModel *model, struct tab *tab,
+			     struct output_info *output_info)
+{
+	XRRModeInfo **mode_infos;
+	gboolean *preferred;
+	int nmode = 0;
+	int n;
+
+	mode_infos = g_new(XRRModeInfo *,
+			   output_info->nmode + tab->advertised->len);
+	preferred = g_new(gboolean,
+			  output_info->nmode + tab->advertised->len);
+
+	for (n = 0; n < output_info->nmode; ++n) {
+		XRRModeInfo *mode_info =
+		    resources_find_mode(res, output_info->modes[n]);
+
+		if (!mode_info)
+			continue;
+
+		mode_infos[nmode] = mode_info;
+		preferred[nmode++] = n < output_info->npreferred;
+	}
+
+	for (n = 0; n < tab->advertised->len; ++n) {
+		mode_infos[nmode] = &g_array_index(tab->advertised,
+						   XRRModeInfo, n);
+		preferred[nmode++] = FALSE;
+	}
+
+	mode_model_update(model, mode_infos, preferred, nmode);
+
+	g_free(mode_infos);
+	g_free(preferred);
+}
+
+static void tab_fill(struct tab *tab, struct output_info *output_info)
+{
+	GtkTreeView *tree_view = GTK_TREE_VIEW(tab->tree);
+	GtkTreeModel *model = gtk_tree_view_get_model(tree_view);
+	GtkTreePath *start;
+	GtkTreeIter iter;
+	int anchor_xid = 0;
+	int anchor_index = -1;
+
+	if (!model) {
+		ModeModel *mode_model = mode_model_new();
+
+		tab_model_update(mode_model, tab, output_info);
+		gtk_tree_view_set_model(tree_view, GTK_TREE_MODEL(mode_model));
+
+		/* The view now holds a reference.  We can get rid of our own
+		 * reference */
+		g_object_unref(G_OBJECT(mode_model));
+		return;
+	}
+
+	/* remember the topmost visible mode to keep it in place */
+	if (gtk_tree_view_get_visible_range(tree_view, &start, NULL)) {
+		if (gtk_tree_model_get_iter(model, &iter, start)) {
+			gtk_tree_model_get(model, &iter, XID_COLUMN,
+					   &anchor_xid, -1);
+			anchor_index = gtk_tree_path_get_indices(start)[0];
+		}
+		gtk_tree_path_free(start);
+	}
+
+	tab_model_update(MODE_MODEL(model), tab, output_info);
+
+	if (anchor_index >= 0) {
+		int index = model_find_xid(model, anchor_xid, &iter);
+
+		/* only rows above the anchor make the view jump */
+		if (index >= 0 && index != anchor_index) {
+			GtkTreePath *path = gtk_tree_model_get_path(model,
+								    &iter);
+
+			/* an alias row in a collapsed group is not shown */
+			if (gtk_tree_path_get_depth(path) > 1) {
+				GtkTreePath *parent = gtk_tree_path_copy(path);
+
+				gtk_tree_path_up(parent);
+				if (!gtk_tree_view_row_expanded(tree_view,
+								parent)) {
+					gtk_tree_path_free(path);
+					path = parent;
+				} else {
+					gtk_tree_path_free(parent);
 				}
 			}
+			gtk_tree_view_scroll_to_cell(tree_view, path, NULL,
+						     TRUE, 0.0, 0.0);
+			gtk_tree_path_free(path);
 		}
 	}
+}
 
-	return 0;
+static const char *monitor_name(struct tab *tab)
+{
+	return tab->edid ? tab->edid->name : "";
 }
 
-static XRRModeInfo *find_mode_by_xid(XRRScreenResources * res, RRMode xid)
+static char *tab_label(struct tab *tab, struct output_info *output_info)
 {
-	unsigned int k;
+	char *label;
+
+	asprintf(&label, "%s(%s)", output_info->name, monitor_name(tab));
+
+	return label;
+}
+
+static void tab_label_update(struct tab *tab, struct output_info *output_info)
+{
+	char *label = tab_label(tab, output_info);
+
+	gtk_label_set_text(GTK_LABEL(tab->label), label);
+	free(label);
+
+	/* a different monitor gets statistics of its own */
+	tab->latency = latency_get(output_info->name, monitor_name(tab));
+	tab_tooltip_update(tab);
+}
+
+/* fetch the EDID extensions of tab, if that has not happened yet */
+static void tab_edid_complete(struct tab *tab)
+{
+	struct output_info *output_info =
+	    resources_find_output(res, tab->output);
+
+	if (tab->edid_complete || !output_info)
+		return;
+
+	tab_edid_update(tab, output_info, TRUE);
+	tab_fill(tab, output_info);
+	tab_label_update(tab, output_info);
+}
 
-	for (k = 0; k < res->nmode; ++k) {
-		XRRModeInfo *mode = &res->modes[k];
+static struct tab *tab_find_page(GtkWidget *page)
+{
+	GHashTableIter it;
+	struct tab *tab;
 
-		if (xid == mode->id)
-			return mode;
+	g_hash_table_iter_init(&it, tabs);
+	while (g_hash_table_iter_next(&it, NULL, (gpointer *) & tab)) {
+		if (tab->page == page)
+			return tab;
 	}
 
 	return NULL;
 }
 
-/* v refresh frequency in Hz */
-static double mode_refresh(const XRRModeInfo * mode_info)
+static void page_switched(GtkNotebook *notebook, GtkWidget *page,
+			  guint page_num, gpointer user_data)
+{
+	struct tab *tab = tab_find_page(page);
+
+	if (tab)
+		tab_edid_complete(tab);
+}
+
+/*
+ * Bring the tabs in line with res. Every mode table is moved over to
+ * the new snapshot, which is cheap for unchanged outputs since their
+ * rows stay. Tab labels are only recomputed for outputs in changed,
+ * pass NULL to redo all of them.
+ */
+static void notebook_update(GtkNotebook *notebook, struct resources *res,
+			    GHashTable *changed)
+{
+	GHashTableIter it;
+	gpointer key;
+	struct tab *tab;
+	int k;
+
+	/* drop the tabs of outputs that went away */
+	g_hash_table_iter_init(&it, tabs);
+	while (g_hash_table_iter_next(&it, &key, (gpointer *) & tab)) {
+		struct output_info *output_info =
+		    resources_find_output(res, tab->output);
+
+		if (output_info && output_shown(res, output_info))
+			continue;
+
+		gtk_notebook_remove_page(notebook,
+					 gtk_notebook_page_num(notebook,
+							       tab->page));
+		g_hash_table_iter_remove(&it);
+	}
+
+	for (k = 0; k < res->noutput; k++) {
+		struct output_info *output_info = &res->outputs[k];
+
+		if (!output_shown(res, output_info))
+			continue;
+
+		key = GUINT_TO_POINTER(output_info->id);
+		tab = g_hash_table_lookup(tabs, key);
+		if (!tab) {
+			tab = tab_new(output_info);
+			g_hash_table_insert(tabs, key, tab);
+		} else if (changed && !g_hash_table_contains(changed, key)) {
+			tab_fill(tab, output_info);
+			continue;
+		}
+
+		/* the other tabs complete theirs once they are shown */
+		tab_edid_update(tab, output_info,
+				tab->page == gtk_notebook_get_nth_page
+				(notebook,
+				 gtk_notebook_get_current_page(notebook)));
+		tab_fill(tab, output_info);
+		tab_label_update(tab, output_info);
+	}
+
+	gtk_widget_show_all(GTK_WIDGET(notebook));
+}
+
+/*
+ * Takes ownership of new_res. The UI is a long running reader: it stays
+ * in a read side section on the snapshot its tabs point into and only
+ * passes a quiescent point once all of them have been moved over. Only
+ * the main thread publishes, so new_res is still current by then.
+ */
+static void resources_replace(struct resources *new_res, GHashTable *changed)
+{
+	resources_publish(new_res);
+
+	res = new_res;
+	notebook_update(GTK_NOTEBOOK(notebook), res, changed);
+
+	resources_read_unlock();
+	res = resources_read_lock();
+	resources_reclaim();
+}
+
+static void keys_to_xids(GHashTable *set, XID **xids, int *n)
+{
+	GHashTableIter it;
+	gpointer key;
+
+	*n = 0;
+	*xids = g_new(XID, g_hash_table_size(set));
+
+	g_hash_table_iter_init(&it, set);
+	while (g_hash_table_iter_next(&it, &key, NULL))
+		(*xids)[(*n)++] = GPOINTER_TO_UINT(key);
+}
+
+static gboolean refresh_timeout(gpointer user_data)
+{
+	struct resources *new_res = NULL;
+	GHashTable *changed;
+	RROutput *outputs;
+	RRCrtc *crtcs;
+	int noutput, ncrtc;
+	int k, n;
+
+	refresh_id = 0;
+
+	keys_to_xids(dirty_outputs, &outputs, &noutput);
+	keys_to_xids(dirty_crtcs, &crtcs, &ncrtc);
+
+	if (!dirty_screen)
+		new_res = resources_update(xcb, root, res, outputs, noutput,
+					   crtcs, ncrtc, NULL, 0);
+
+	if (!new_res) {
+		new_res = resources_get(xcb, root, 0);
+		if (new_res)
+			resources_replace(new_res, NULL);
+	} else {
+		/* a crtc change affects every output driven by it */
+		changed = g_hash_table_new(g_direct_hash, g_direct_equal);
+		for (k = 0; k < noutput; ++k)
+			g_hash_table_add(changed, GUINT_TO_POINTER(outputs[k]));
+		for (k = 0; k < ncrtc; ++k) {
+			struct crtc_info *crtc_info =
+			    resources_find_crtc(new_res, crtcs[k]);
+
+			for (n = 0; crtc_info && n < crtc_info->noutput; ++n)
+				g_hash_table_add(changed,
+						 GUINT_TO_POINTER(crtc_info->
+								  outputs[n]));
+		}
+
+		resources_replace(new_res, changed);
+		g_hash_table_destroy(changed);
+	}
+
+	g_free(outputs);
+	g_free(crtcs);
+	g_hash_table_remove_all(dirty_outputs);
+	g_hash_table_remove_all(dirty_crtcs);
+	dirty_screen = FALSE;
+
+	return G_SOURCE_REMOVE;
+}
+
+/* finish timing the mode switch that ev is the result of, if any */
+static void crtc_change_latency(XRRCrtcChangeNotifyEvent *ev)
+{
+	gint64 now = g_get_monotonic_time();
+	GHashTableIter it;
+	struct tab *tab;
+
+	g_hash_table_iter_init(&it, tabs);
+	while (g_hash_table_iter_next(&it, NULL, (gpointer *) & tab)) {
+		if (!tab->notify_pending || tab->apply_crtc != ev->crtc ||
+		    tab->apply_mode != ev->mode)
+			continue;
+
+		tab->notify_pending = FALSE;
+		histogram_record(&tab->latency->notify, now - tab->apply_start);
+		tab_tooltip_update(tab);
+	}
+}
+
+static void x_event_handle(XEvent *event)
 {
-	double rate;
-	double vTotal = mode_info->vTotal;
+	XRRNotifyEvent *notify = (XRRNotifyEvent *) event;
+
+	if (event->type == rr_event_base + RRScreenChangeNotify) {
+		dirty_screen = TRUE;
+	} else if (event->type == rr_event_base + RRNotify) {
+		if (notify->subtype == RRNotify_OutputChange) {
+			XRROutputChangeNotifyEvent *ev =
+			    (XRROutputChangeNotifyEvent *) event;
+
+			g_hash_table_add(dirty_outputs,
+					 GUINT_TO_POINTER(ev->output));
+		} else if (notify->subtype == RRNotify_CrtcChange) {
+			XRRCrtcChangeNotifyEvent *ev =
+			    (XRRCrtcChangeNotifyEvent *) event;
 
-	if (mode_info->modeFlags & RR_DoubleScan) {
-		/* doublescan doubles the number of lines */
-		vTotal *= 2;
+			g_hash_table_add(dirty_crtcs,
+					 GUINT_TO_POINTER(ev->crtc));
+			crtc_change_latency(ev);
+		} else {
+			return;
+		}
+	} else {
+		return;
 	}
 
-	if (mode_info->modeFlags & RR_Interlace) {
-		/* interlace splits the frame into two fields */
-		/* the field rate is what is typically reported by monitors */
-		vTotal /= 2;
+	/* a hotplug sends a burst of events, handle them in one go */
+	if (!refresh_id)
+		refresh_id = g_timeout_add(REFRESH_DELAY_MS, refresh_timeout,
+					   NULL);
+}
+
+static gboolean x_source_prepare(GSource *source, gint *timeout)
+{
+	*timeout = -1;
+
+	/* xcb replies may have pulled events off the socket already */
+	return XEventsQueued(dpy, QueuedAfterReading) > 0;
+}
+
+static gboolean x_source_check(GSource *source)
+{
+	return XPending(dpy) > 0;
+}
+
+static gboolean x_source_dispatch(GSource *source, GSourceFunc callback,
+				  gpointer user_data)
+{
+	XEvent event;
+
+	while (XPending(dpy)) {
+		XNextEvent(dpy, &event);
+		x_event_handle(&event);
 	}
 
-	if (mode_info->hTotal && vTotal)
-		rate = ((double)mode_info->dotClock /
-			((double)mode_info->hTotal * (double)vTotal));
+	return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs x_source_funcs = {
+	x_source_prepare,
+	x_source_check,
+	x_source_dispatch,
+	NULL
+};
+
+static void x_source_add(void)
+{
+	GSource *source;
+	int rr_error_base;
+
+	if (!XRRQueryExtension(dpy, &rr_event_base, &rr_error_base))
+		return;
+
+	XRRSelectInput(dpy, root, RRScreenChangeNotifyMask |
+		       RROutputChangeNotifyMask | RRCrtcChangeNotifyMask);
+	XFlush(dpy);
+
+	dirty_outputs = g_hash_table_new(g_direct_hash, g_direct_equal);
+	dirty_crtcs = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	source = g_source_new(&x_source_funcs, sizeof(GSource));
+	g_source_set_name(source, "X events");
+	g_source_add_unix_fd(source, ConnectionNumber(dpy), G_IO_IN);
+	g_source_attach(source, NULL);
+	g_source_unref(source);
+}
+
+static void probe_thread(GTask *task, gpointer source_object,
+			 gpointer task_data, GCancellable *cancellable)
+{
+	const char *display_name = task_data;
+	struct resources *probed = NULL;
+	xcb_connection_t *c;
+	int screen_num;
+
+	/* probing blocks the connection, so use a private one */
+	c = xcb_connect(display_name, &screen_num);
+	if (!xcb_connection_has_error(c))
+		probed = resources_get(c, screen_root(c, screen_num), 1);
+	xcb_disconnect(c);
+
+	if (probed)
+		g_task_return_pointer(task, probed,
+				      (GDestroyNotify) resources_free);
 	else
-		rate = 0;
-	return rate;
+		g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+					"probing %s failed", display_name);
 }
 
-void row_activated(GtkTreeView * tree_view,
-		   GtkTreePath * path,
-		   GtkTreeViewColumn * column, gpointer user_data)
+static void probe_done(GObject *source_object, GAsyncResult *result,
+		       gpointer user_data)
 {
-	GtkTreeModel *model;
-	GtkTreeIter iter;
+	GError *error = NULL;
+	struct resources *probed;
 
-	model = gtk_tree_view_get_model(tree_view);
-	if (gtk_tree_model_get_iter(model, &iter, path)) {
-		int xid;
-		XRROutputInfo *output_info =
-		    XRRGetOutputInfo(dpy, res, *(XID *) user_data);
+	probed = g_task_propagate_pointer(G_TASK(result), &error);
+	if (probed) {
+		resources_replace(probed, NULL);
+	} else {
+		g_warning("%s\n", error->message);
+		g_error_free(error);
+	}
 
-		gtk_tree_model_get(model, &iter, XID_COLUMN, &xid, -1);
-		XRRSetCrtcConfig(dpy, res, output_info->crtc, CurrentTime, 0, 0,
-				 xid, RR_Rotate_0, (XID *) user_data, 1);
+	g_simple_action_set_enabled(probe_action, TRUE);
+}
+
+static void probe_activated(GSimpleAction *action, GVariant *parameter,
+			    gpointer user_data)
+{
+	GTask *task;
+
+	g_simple_action_set_enabled(action, FALSE);
+
+	task = g_task_new(NULL, NULL, probe_done, NULL);
+	g_task_set_task_data(task, g_strdup(XDisplayString(dpy)), g_free);
+	g_task_run_in_thread(task, probe_thread);
+	g_object_unref(task);
+}
+
+static void sweep_write(const char *output, GArray *results)
+{
+	FILE *f = stdout;
+
+	if (opt_sweep_results && strcmp(opt_sweep_results, "-")) {
+		f = fopen(opt_sweep_results, "w");
+		if (!f) {
+			g_warning("cannot write %s\n", opt_sweep_results);
+			return;
+		}
+	}
+
+	if (opt_sweep_results && g_str_has_suffix(opt_sweep_results, ".json"))
+		sweep_write_json(f, output, results);
+	else
+		sweep_write_csv(f, output, results);
+
+	if (f != stdout)
+		fclose(f);
+}
+
+static void sweep_done(RROutput output, GArray *results, gpointer user_data)
+{
+	struct tab *tab = g_hash_table_lookup(tabs, GUINT_TO_POINTER(output));
+	struct output_info *output_info = resources_find_output(res, output);
+	GApplication *app = user_data;
+
+	if (tab)
+		tab_set_pending(tab, FALSE);
+
+	sweep_write(output_info ? output_info->name : "", results);
+	g_simple_action_set_enabled(sweep_action, TRUE);
+
+	/* started from the command line */
+	if (app)
+		g_application_quit(app);
+}
+
+static const char *sweep_check(const XRRModeInfo *mode_info, gpointer user_data)
+{
+	return mode_refusal(user_data, mode_info, opt_force);
+}
+
+static void sweep_output(struct output_info *output_info, GApplication *app)
+{
+	struct tab *tab = g_hash_table_lookup(tabs,
+					      GUINT_TO_POINTER(output_info->id));
+
+	if (tab && tab->pending)
+		return;
+
+	if (sweep_start(res, output_info->id, sweep_check, tab, sweep_done,
+			app)) {
+		g_warning("output %s is not active, cannot sweep\n",
+			  output_info->name);
+		if (app)
+			g_application_quit(app);
+		return;
+	}
+
+	if (tab)
+		tab_set_pending(tab, TRUE);
+	g_simple_action_set_enabled(sweep_action, FALSE);
+}
+
+static struct tab *tab_current(void)
+{
+	GtkNotebook *nb = GTK_NOTEBOOK(notebook);
+
+	return tab_find_page(gtk_notebook_get_nth_page
+			     (nb, gtk_notebook_get_current_page(nb)));
+}
+
+/* sweep the output of the current tab */
+static void sweep_activated(GSimpleAction *action, GVariant *parameter,
+			    gpointer user_data)
+{
+	struct tab *tab = tab_current();
+	struct output_info *output_info;
+
+	if (!tab)
+		return;
+
+	output_info = resources_find_output(res, tab->output);
+	if (output_info)
+		sweep_output(output_info, NULL);
+}
+
+/*
+ * Generate width x height at each of rates and add the modes to the
+ * output of tab as one batch, after taking off the generated modes it
+ * does not need any more. The new snapshot is put together from the
+ * modes just created, so the rows show up without a full query.
+ */
+static void modes_inject(struct tab *tab, enum timing_method method,
+			 unsigned int width, unsigned int height,
+			 char **rates)
+{
+	GArray *modes = g_array_new(FALSE, FALSE, sizeof(XRRModeInfo));
+	XRRModeInfo *mode_info;
+	struct resources *new_res;
+	GHashTable *changed;
+	int k;
+
+	for (; *rates; ++rates) {
+		XRRModeInfo generated;
+		const char *error;
+
+		if (!**rates)
+			continue;
+
+		if (timing_generate(method, width, height,
+				    g_ascii_strtod(*rates, NULL), &generated)) {
+			g_warning("cannot generate %ux%u at %s Hz\n", width,
+				  height, *rates);
+			continue;
+		}
+
+		error = timing_validate(&generated);
+		if (!error && active_link && !link_fits(active_link, &generated))
+			error = "does not fit the link";
+		if (error) {
+			g_warning("%s: %s\n", generated.name, error);
+			g_free(generated.name);
+			continue;
+		}
+		g_array_append_val(modes, generated);
+	}
+	mode_info = (XRRModeInfo *) modes->data;
+
+	output_modes_prune(xcb, res, tab->output, mode_info, modes->len);
+	if (modes->len) {
+		int added = output_modes_add(xcb, root, res, tab->output,
+					     mode_info, modes->len);
+
+		if (added < 0 || (guint)added < modes->len)
+			g_warning("not all modes could be added to output "
+				  "0x%x\n", (unsigned int)tab->output);
+	}
+
+	/* otherwise the RandR events bring the modes in */
+	new_res = resources_update(xcb, root, res, &tab->output, 1, NULL, 0,
+				   mode_info, modes->len);
+	if (new_res) {
+		changed = g_hash_table_new(g_direct_hash, g_direct_equal);
+		g_hash_table_add(changed, GUINT_TO_POINTER(tab->output));
+		resources_replace(new_res, changed);
+		g_hash_table_destroy(changed);
+	}
+
+	for (k = 0; k < modes->len; ++k)
+		g_free(mode_info[k].name);
+	g_array_free(modes, TRUE);
+}
+
+static GtkWidget *grid_row_add(GtkWidget *grid, int row, const char *label,
+			       GtkWidget *widget)
+{
+	GtkWidget *l = gtk_label_new(label);
+
+	gtk_widget_set_halign(l, GTK_ALIGN_START);
+	gtk_grid_attach(GTK_GRID(grid), l, 0, row, 1, 1);
+	gtk_grid_attach(GTK_GRID(grid), widget, 1, row, 1, 1);
+
+	return widget;
+}
+
+/* ask for size, rates and formula, then add modes to the current tab */
+static void add_modes_activated(GSimpleAction *action, GVariant *parameter,
+				gpointer user_data)
+{
+	struct tab *tab = tab_current();
+	struct output_info *output_info;
+	struct crtc_info *crtc_info = NULL;
+	GtkWidget *dialog, *grid, *size, *rates, *method;
+	char text[32] = "";
+
+	if (!tab)
+		return;
+
+	output_info = resources_find_output(res, tab->output);
+	if (output_info)
+		crtc_info = resources_find_crtc(res, output_info->crtc);
+	if (crtc_info)
+		snprintf(text, sizeof(text), "%ux%u", crtc_info->width,
+			 crtc_info->height);
+
+	dialog = gtk_dialog_new_with_buttons("Add modes",
+					     GTK_WINDOW(gtk_widget_get_toplevel
+							(notebook)),
+					     GTK_DIALOG_MODAL |
+					     GTK_DIALOG_DESTROY_WITH_PARENT,
+					     "_Cancel", GTK_RESPONSE_CANCEL,
+					     "_Add", GTK_RESPONSE_ACCEPT, NULL);
+	gtk_dialog_set_default_response(GTK_DIALOG(dialog),
+					GTK_RESPONSE_ACCEPT);
+
+	grid = gtk_grid_new();
+	gtk_grid_set_row_spacing(GTK_GRID(grid), 4);
+	gtk_grid_set_column_spacing(GTK_GRID(grid), 8);
+	gtk_container_set_border_width(GTK_CONTAINER(grid), 8);
+
+	size = grid_row_add(grid, 0, "Size", gtk_entry_new());
+	gtk_entry_set_text(GTK_ENTRY(size), text);
+	gtk_entry_set_activates_default(GTK_ENTRY(size), TRUE);
+
+	rates = grid_row_add(grid, 1, "Refresh rates", gtk_entry_new());
+	gtk_entry_set_text(GTK_ENTRY(rates), "60");
+	gtk_entry_set_activates_default(GTK_ENTRY(rates), TRUE);
+	gtk_widget_set_tooltip_text(rates, "In Hz, separated by commas");
+
+	/* in the order of enum timing_method */
+	method = grid_row_add(grid, 2, "Timing", gtk_combo_box_text_new());
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(method), "CVT");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(method),
+				       "CVT reduced blanking");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(method),
+				       "CVT reduced blanking v2");
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(method), "GTF");
+	gtk_combo_box_set_active(GTK_COMBO_BOX(method), TIMING_CVT_RB);
+
+	gtk_container_add(GTK_CONTAINER
+			  (gtk_dialog_get_content_area(GTK_DIALOG(dialog))),
+			  grid);
+	gtk_widget_show_all(grid);
+
+	if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+		unsigned int width, height;
+		char **list;
+
+		if (sscanf(gtk_entry_get_text(GTK_ENTRY(size)), "%ux%u",
+			   &width, &height) == 2) {
+			list = g_strsplit_set(gtk_entry_get_text
+					      (GTK_ENTRY(rates)), ", ", -1);
+			modes_inject(tab, gtk_combo_box_get_active
+				     (GTK_COMBO_BOX(method)), width, height,
+				     list);
+			g_strfreev(list);
+		} else {
+			g_warning("size has to be WIDTHxHEIGHT\n");
+		}
+	}
+	gtk_widget_destroy(dialog);
+}
+
+struct clone_dialog {
+	unsigned long serial;	/* of the snapshot modes index into */
+	GPtrArray *checks;	/* GtkCheckButton, output in its data */
+	GtkWidget *combo;
+	GArray *modes;		/* int, rows of combo */
+};
+
+/* the outputs ticked in dlg */
+static GArray *clone_outputs(struct clone_dialog *dlg)
+{
+	GArray *outputs = g_array_new(FALSE, FALSE, sizeof(RROutput));
+	unsigned int k;
+
+	for (k = 0; k < dlg->checks->len; ++k) {
+		GtkWidget *check = g_ptr_array_index(dlg->checks, k);
+		RROutput output =
+		    GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(check),
+						       "output"));
+
+		if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(check)))
+			g_array_append_val(outputs, output);
+	}
+
+	return outputs;
+}
+
+/*
+ * Rank the modes all ticked outputs share in the current snapshot,
+ * leaving out refused ones. The dialog runs a main loop, so that may
+ * be another one than last time.
+ */
+static void clone_toggled(GtkToggleButton *button, gpointer user_data)
+{
+	struct clone_dialog *dlg = user_data;
+	GArray *outputs = clone_outputs(dlg);
+	GArray *modes;
+	unsigned int k, o;
+
+	if (dlg->modes)
+		g_array_free(dlg->modes, TRUE);
+	dlg->modes = g_array_new(FALSE, FALSE, sizeof(int));
+	gtk_combo_box_text_remove_all(GTK_COMBO_BOX_TEXT(dlg->combo));
+
+	dlg->serial = res->serial;
+	modes = outputs->len > 1 ?
+	    clone_modes(res, (RROutput *) outputs->data, outputs->len) :
+	    g_array_new(FALSE, FALSE, sizeof(int));
+
+	for (k = 0; k < modes->len; ++k) {
+		int index = g_array_index(modes, int, k);
+		XRRModeInfo *mode_info = &res->modes[index];
+		char *text;
+
+		for (o = 0; o < outputs->len; ++o) {
+			struct tab *tab = g_hash_table_lookup(tabs,
+				GUINT_TO_POINTER(g_array_index(outputs,
+							       RROutput, o)));
+
+			if (mode_refusal(tab, mode_info, FALSE))
+				break;
+		}
+		if (o < outputs->len)
+			continue;
+
+		text = g_strdup_printf("%ux%u @ %.2f Hz", mode_info->width,
+				       mode_info->height,
+				       res->table.refresh[index]);
+		gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(dlg->combo),
+					       text);
+		g_free(text);
+		g_array_append_val(dlg->modes, index);
+	}
+	gtk_combo_box_set_active(GTK_COMBO_BOX(dlg->combo),
+				 dlg->modes->len ? 0 : -1);
+
+	g_array_free(modes, TRUE);
+	g_array_free(outputs, TRUE);
+}
+
+static void clone_done(RROutput output, RRMode mode, int status,
+		       gboolean skipped, gint64 reply_time, gpointer user_data)
+{
+	if (status)
+		g_warning("cloning mode 0x%x from output 0x%x failed (%d)\n",
+			  (unsigned int)mode, (unsigned int)output, status);
+}
+
+/*
+ * Drive the ticked outputs with the timing in row active of the combo,
+ * all at the origin and in one transaction.
+ */
+static void clone_apply(struct clone_dialog *dlg, int active)
+{
+	struct transaction *t;
+	GArray *outputs;
+	unsigned int k;
+	int index;
+
+	if (active < 0)
+		return;
+	/* the rows were ranked for a snapshot that is gone now */
+	if (dlg->serial != res->serial) {
+		g_warning("outputs changed, mode not cloned\n");
+		return;
+	}
+
+	index = g_array_index(dlg->modes, int, active);
+	outputs = clone_outputs(dlg);
+	t = transaction_new();
+	for (k = 0; k < outputs->len; ++k) {
+		RROutput output = g_array_index(outputs, RROutput, k);
+		struct output_info *output_info =
+		    resources_find_output(res, output);
+
+		if (output_info)
+			transaction_set(t, output,
+					clone_mode_for(res, output_info,
+						       index), 0, 0);
+	}
+	transaction_commit(t, clone_done, NULL);
+
+	g_array_free(outputs, TRUE);
+}
+
+/* pick outputs and one of the modes they all support, then apply it */
+static void clone_activated(GSimpleAction *action, GVariant *parameter,
+			    gpointer user_data)
+{
+	struct clone_dialog dlg = { 0 };
+	GtkWidget *dialog, *grid, *check;
+	GHashTableIter it;
+	struct tab *tab;
+	int row = 0;
+
+	dialog = gtk_dialog_new_with_buttons("Clone",
+					     GTK_WINDOW(gtk_widget_get_toplevel
+							(notebook)),
+					     GTK_DIALOG_MODAL |
+					     GTK_DIALOG_DESTROY_WITH_PARENT,
+					     "_Cancel", GTK_RESPONSE_CANCEL,
+					     "_Apply", GTK_RESPONSE_ACCEPT, NULL);
+	gtk_dialog_set_default_response(GTK_DIALOG(dialog),
+					GTK_RESPONSE_ACCEPT);
+
+	grid = gtk_grid_new();
+	gtk_grid_set_row_spacing(GTK_GRID(grid), 4);
+	gtk_grid_set_column_spacing(GTK_GRID(grid), 8);
+	gtk_container_set_border_width(GTK_CONTAINER(grid), 8);
+
+	dlg.checks = g_ptr_array_new();
+	dlg.combo = gtk_combo_box_text_new();
+
+	g_hash_table_iter_init(&it, tabs);
+	while (g_hash_table_iter_next(&it, NULL, (gpointer *) & tab)) {
+		struct output_info *output_info =
+		    resources_find_output(res, tab->output);
+
+		if (!output_info)
+			continue;
+
+		/* the HDMI limits come from the extension blocks */
+		tab_edid_complete(tab);
+
+		check = gtk_check_button_new_with_label(output_info->name);
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check), TRUE);
+		g_object_set_data(G_OBJECT(check), "output",
+				  GUINT_TO_POINTER(tab->output));
+		g_signal_connect(check, "toggled", G_CALLBACK(clone_toggled),
+				 &dlg);
+		gtk_grid_attach(GTK_GRID(grid), check, 0, row++, 2, 1);
+		g_ptr_array_add(dlg.checks, check);
+	}
+	grid_row_add(grid, row, "Mode", dlg.combo);
+	clone_toggled(NULL, &dlg);
+
+	gtk_container_add(GTK_CONTAINER
+			  (gtk_dialog_get_content_area(GTK_DIALOG(dialog))),
+			  grid);
+	gtk_widget_show_all(grid);
+
+	if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+		clone_apply(&dlg, gtk_combo_box_get_active
+			    (GTK_COMBO_BOX(dlg.combo)));
+	gtk_widget_destroy(dialog);
+
+	g_array_free(dlg.modes, TRUE);
+	g_ptr_array_free(dlg.checks, TRUE);
+}
+
+static void link_changed(GtkComboBox *combo, gpointer user_data)
+{
+	int active = gtk_combo_box_get_active(combo);
+	GHashTableIter it;
+	struct tab *tab;
+
+	active_link = active > 0 ? link_get(active - 1) : NULL;
+
+	g_hash_table_iter_init(&it, tabs);
+	while (g_hash_table_iter_next(&it, NULL, (gpointer *) & tab))
+		gtk_widget_queue_draw(tab->tree);
+}
+
+static GtkWidget *link_combo_new(void)
+{
+	GtkWidget *combo = gtk_combo_box_text_new();
+	int k;
+
+	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo),
+				       "No link limit");
+	for (k = 0; k < link_count(); ++k) {
+		gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo),
+					       link_get(k)->name);
+		if (active_link == link_get(k))
+			gtk_combo_box_set_active(GTK_COMBO_BOX(combo), k + 1);
+	}
+	if (!active_link)
+		gtk_combo_box_set_active(GTK_COMBO_BOX(combo), 0);
+
+	gtk_widget_set_tooltip_text(combo,
+				    "Modes that do not fit through the link "
+				    "are not applied");
+	g_signal_connect(combo, "changed", G_CALLBACK(link_changed), NULL);
+
+	return combo;
+}
+
+/* standard profiles, those from the config file and the one asked for */
+static void link_setup(void)
+{
+	char *config = opt_link_config;
+
+	if (!config)
+		config = g_build_filename(g_get_user_config_dir(),
+					  "gresolutions", "links.conf", NULL);
+	link_init(config);
+	if (config != opt_link_config)
+		g_free(config);
+
+	if (opt_link) {
+		active_link = link_find(opt_link);
+		if (!active_link)
+			g_warning("no link profile %s\n", opt_link);
 	}
 }
 
 static void activate(GtkApplication * app, gpointer user_data)
 {
+	GSimpleAction *action;
 	GtkWidget *window;
-	GtkWidget *notebook;
-	unsigned int k;
+	GtkWidget *header;
+	GtkWidget *button;
 	char *label;
 
 	dpy = XOpenDisplay(NULL);
 	screen = DefaultScreen(dpy);
 	root = RootWindow(dpy, screen);
-	res = XRRGetScreenResources(dpy, root);
+	xcb = XGetXCBConnection(dpy);
+	res = resources_get(xcb, root, 0);
+	if (!res) {
+		g_warning("querying RandR resources failed\n");
+		return;
+	}
+	resources_publish(res);
+	res = resources_read_lock();
+	apply_init(XDisplayString(dpy));
+	link_setup();
+
+	probe_action = g_simple_action_new("probe", NULL);
+	g_signal_connect(probe_action, "activate",
+			 G_CALLBACK(probe_activated), NULL);
+	g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(probe_action));
+
+	sweep_action = g_simple_action_new("sweep", NULL);
+	g_signal_connect(sweep_action, "activate",
+			 G_CALLBACK(sweep_activated), NULL);
+	g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(sweep_action));
+
+	action = g_simple_action_new("add-modes", NULL);
+	g_signal_connect(action, "activate", G_CALLBACK(add_modes_activated),
+			 NULL);
+	g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(action));
+	g_object_unref(action);
+
+	action = g_simple_action_new("clone", NULL);
+	g_signal_connect(action, "activate", G_CALLBACK(clone_activated),
+			 NULL);
+	g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(action));
+	g_object_unref(action);
 
 	window = gtk_application_window_new(app);
 	asprintf(&label, "gresolutions%s", XDisplayString(dpy));
 	gtk_window_set_title(GTK_WINDOW(window), label);
+	gtk_window_set_default_size(GTK_WINDOW(window), 200, 400);
+
+	header = gtk_header_bar_new();
+	gtk_header_bar_set_title(GTK_HEADER_BAR(header), label);
+	gtk_header_bar_set_show_close_button(GTK_HEADER_BAR(header), TRUE);
+	gtk_window_set_titlebar(GTK_WINDOW(window), header);
 	free(label);
-	gtk_window_set_default_size(GTK_WINDOW(window), 200, 200);
 
+	button = gtk_button_new_with_label("Probe hardware");
+	gtk_widget_set_tooltip_text(button,
+				    "Make the X server poll all connectors");
+	gtk_actionable_set_action_name(GTK_ACTIONABLE(button), "app.probe");
+	gtk_header_bar_pack_end(GTK_HEADER_BAR(header), button);
+
+	button = gtk_button_new_with_label("Sweep modes");
+	gtk_widget_set_tooltip_text(button,
+				    "Apply every mode of the current output "
+				    "and report how long each took");
+	gtk_actionable_set_action_name(GTK_ACTIONABLE(button), "app.sweep");
+	gtk_header_bar_pack_end(GTK_HEADER_BAR(header), button);
+
+	button = gtk_button_new_with_label("Add modes");
+	gtk_widget_set_tooltip_text(button,
+				    "Generate CVT or GTF timings and add them "
+				    "to the current output");
+	gtk_actionable_set_action_name(GTK_ACTIONABLE(button),
+				       "app.add-modes");
+	gtk_header_bar_pack_end(GTK_HEADER_BAR(header), button);
+
+	button = gtk_button_new_with_label("Clone");
+	gtk_widget_set_tooltip_text(button,
+				    "Drive several outputs with a mode they "
+				    "all support");
+	gtk_actionable_set_action_name(GTK_ACTIONABLE(button), "app.clone");
+	gtk_header_bar_pack_end(GTK_HEADER_BAR(header), button);
+
+	gtk_header_bar_pack_start(GTK_HEADER_BAR(header), link_combo_new());
+
+	tabs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+				     (GDestroyNotify) tab_free);
 	notebook = gtk_notebook_new();
 	gtk_container_add(GTK_CONTAINER(window), notebook);
+	g_signal_connect(notebook, "switch-page", G_CALLBACK(page_switched),
+			 NULL);
+	notebook_update(GTK_NOTEBOOK(notebook), res, NULL);
 
-	for (k = 0; k < res->noutput; k++) {
-		unsigned int n;
-		unsigned char *edid;
-		unsigned long edid_length;
-		char modelname[13] = "";
-		char *label;
-
-		XRROutputInfo *output_info =
-		    XRRGetOutputInfo(dpy, res, res->outputs[k]);
-		XRRCrtcInfo *crtc_info;
-		GtkTreeIter iter;
-		GtkWidget *tree;
-		GtkTreeViewColumn *column;
-		GtkCellRenderer *renderer;
-		GtkListStore *list_store = gtk_list_store_new(N_COLUMNS,
-							      G_TYPE_INT,
-							      G_TYPE_STRING,
-							      G_TYPE_STRING,
-							      G_TYPE_STRING,
-							      G_TYPE_STRING,
-							      G_TYPE_BOOLEAN);
-
-		if (output_info->connection == RR_Disconnected)
-			continue;
+	x_source_add();
 
-		if (!output_info->crtc)
-			continue;
+	gtk_widget_show_all(window);
 
-		crtc_info = XRRGetCrtcInfo(dpy, res, output_info->crtc);
-		if (!crtc_info)
-			continue;
+	if (opt_probe)
+		probe_activated(probe_action, NULL, NULL);
+
+	if (opt_sweep) {
+		int k;
 
-		edid = output_edid_get(res->outputs[k], &edid_length);
-		if (edid && edid_length)
-			parseedid(edid, modelname);
-
-		for (n = 0; n < output_info->nmode; ++n) {
-			char *xid_string;
-			char *name;
-			char *refresh;
-			char *pixclock;
-			XRRModeInfo *mode_info;
-
-			mode_info =
-			    find_mode_by_xid(res, output_info->modes[n]);
-			if (!mode_info)
-				continue;
-
-			asprintf(&xid_string, "0x%x", output_info->modes[n]);
-			asprintf(&name, mode_info->name);
-			asprintf(&refresh, "%6.2fHz", mode_refresh(mode_info));
-			asprintf(&pixclock, "%6.3fMHz",
-				 (double)mode_info->dotClock / 1000000.0);
-
-			gtk_list_store_append(list_store, &iter);
-			gtk_list_store_set(list_store, &iter,
-					   XID_COLUMN, output_info->modes[n],
-					   XID_STRING_COLUMN, xid_string,
-					   NAME_COLUMN, name,
-					   REFRESH_COLUMN, refresh,
-					   PIXCLOCK_COLUMN, pixclock,
-					   PREFERRED_COLUMN,
-					   n < output_info->npreferred, -1);
-
-			free(xid_string);
-			free(name);
-			free(refresh);
-			free(pixclock);
+		for (k = 0; k < res->noutput; ++k) {
+			if (!strcmp(res->outputs[k].name, opt_sweep))
+				break;
 		}
+		if (k < res->noutput) {
+			sweep_output(&res->outputs[k], G_APPLICATION(app));
+		} else {
+			g_warning("no output %s\n", opt_sweep);
+			g_application_quit(G_APPLICATION(app));
+		}
+	}
+}
 
-		/* Create a view */
-		tree = gtk_tree_view_new_with_model(GTK_TREE_MODEL(list_store));
-		g_signal_connect(tree, "row-activated",
-				 G_CALLBACK(row_activated), &res->outputs[k]);
+/* headless modes run before GTK or X get involved */
+static gint handle_local_options(GApplication *app, GVariantDict *options,
+				 gpointer user_data)
+{
+	if (opt_inspect)
+		return inspect_run(opt_inspect);
+	if (opt_drm)
+		return drm_sysfs_list(opt_sysfs_root);
+	if (opt_modeline)
+		return timing_print(opt_modeline);
 
-		/* The view now holds a reference.  We can get rid of our own
-		 * reference */
-		g_object_unref(G_OBJECT(list_store));
-
-		renderer = gtk_cell_renderer_text_new();
-		g_object_set(G_OBJECT(renderer), "foreground", "red", NULL);
-		column = gtk_tree_view_column_new_with_attributes("XID",
-								  renderer,
-								  "text",
-								  XID_STRING_COLUMN,
-								  NULL);
-		gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
-
-		renderer = gtk_cell_renderer_toggle_new();
-		g_object_set(G_OBJECT(renderer), "radio", TRUE, NULL);
-		column = gtk_tree_view_column_new_with_attributes("Preferred",
-								  renderer,
-								  "active",
-								  PREFERRED_COLUMN,
-								  NULL);
-		gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
-
-		renderer = gtk_cell_renderer_text_new();
-		column = gtk_tree_view_column_new_with_attributes("Mode",
-								  renderer,
-								  "text",
-								  NAME_COLUMN,
-								  NULL);
-		gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
-
-		column = gtk_tree_view_column_new_with_attributes("Refresh",
-								  renderer,
-								  "text",
-								  REFRESH_COLUMN,
-								  NULL);
-		gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
-
-		column = gtk_tree_view_column_new_with_attributes("Pixclock",
-								  renderer,
-								  "text",
-								  PIXCLOCK_COLUMN,
-								  NULL);
-		gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
-
-		asprintf(&label, "%s(%s)", output_info->name, modelname);
-
-		gtk_notebook_append_page(GTK_NOTEBOOK(notebook), tree,
-					 gtk_label_new(label));
-
-		free(label);
+	return -1;
+}
+
+static void app_shutdown(GApplication *app, gpointer user_data)
+{
+	FILE *f;
+
+	if (!opt_latency_dump)
+		return;
+
+	if (!strcmp(opt_latency_dump, "-")) {
+		latency_dump(stdout);
+		return;
 	}
 
-	gtk_widget_show_all(window);
+	f = fopen(opt_latency_dump, "w");
+	if (!f) {
+		g_warning("cannot write %s\n", opt_latency_dump);
+		return;
+	}
+	latency_dump(f);
+	fclose(f);
 }
 
 int main(int argc, char **argv)
@@ -321,8 +1719,15 @@ int main(int argc, char **argv)
 	GtkApplication *app;
 	int status;
 
+	/* the apply worker has a Display of its own */
+	XInitThreads();
+
 	app = gtk_application_new("org.gtk.example", G_APPLICATION_FLAGS_NONE);
+	g_application_add_main_option_entries(G_APPLICATION(app), options);
 	g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
+	g_signal_connect(app, "shutdown", G_CALLBACK(app_shutdown), NULL);
+	g_signal_connect(app, "handle-local-options",
+			 G_CALLBACK(handle_local_options), NULL);
 	status = g_application_run(G_APPLICATION(app), argc, argv);
 	g_object_unref(app);
 
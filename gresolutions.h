@@ -0,0 +1,456 @@
+/*
+ * gresolutions.h
+ *
+ * Shared types of gresolutions.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GRESOLUTIONS_H
+#define GRESOLUTIONS_H
+
+#include <stdio.h>
+
+#include <glib.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrandr.h>
+#include <xcb/xcb.h>
+
+/*
+ * Backend independent copy of the RandR state. Modes use the Xlib
+ * XRRModeInfo layout so they can be handed to the usual helpers.
+ *
+ * Snapshots are immutable once frozen, a change always produces a new
+ * snapshot that replaces the old one as a whole.
+ */
+struct output_info {
+	RROutput id;
+	char *name;
+	int nameLen;
+	Connection connection;
+	RRCrtc crtc;
+	int nmode;
+	int npreferred;
+	RRMode *modes;
+	/* base block only, see output_edid_get() for the extensions */
+	unsigned char *edid;
+	unsigned long edid_length;
+	unsigned long edid_bytes_after;
+	/*
+	 * bit k is set if the output lists a mode with the timing of
+	 * mode k of the snapshot, see mode_table.timing
+	 */
+	gulong *mode_bits;
+};
+
+#define MODE_BITS_PER_WORD (8 * sizeof(gulong))
+#define MODE_BITS_WORDS(nmode) \
+	(((nmode) + MODE_BITS_PER_WORD - 1) / MODE_BITS_PER_WORD)
+
+struct crtc_info {
+	RRCrtc id;
+	int x, y;
+	unsigned int width, height;
+	RRMode mode;
+	Rotation rotation;
+	int noutput;
+	RROutput *outputs;
+};
+
+/*
+ * The modes of a snapshot as a struct of arrays, indexed like
+ * resources.modes, with metrics precomputed by mode_table_compute().
+ */
+struct mode_table {
+	int n;
+	/* inputs */
+	double *dot_clock;	/* Hz */
+	double *htotal;
+	double *vtotal;
+	double *vscan;		/* lines per refresh, after scan doubling */
+	double *width;
+	double *height;
+	unsigned int *flags;
+	/* metrics */
+	double *refresh;	/* Hz */
+	double *hfreq;		/* Hz */
+	double *blanking;	/* share of the frame, 0..1 */
+	double *bandwidth;	/* bit/s at 24 bpp */
+	/* index of the first mode with the same timing */
+	int *timing;
+};
+
+struct resources {
+	unsigned long serial;	/* set when published */
+	Atom edid_atom;
+	Time timestamp;
+	Time config_timestamp;
+	int ncrtc;
+	struct crtc_info *crtcs;
+	int noutput;
+	struct output_info *outputs;
+	int nmode;
+	XRRModeInfo *modes;
+	/* open addressing index into modes, see resources_find_mode() */
+	unsigned int *mode_slots;
+	unsigned int mode_mask;
+	struct mode_table table;
+};
+
+/* resources.c */
+struct resources *resources_freeze(const struct resources *draft);
+void resources_free(struct resources *res);
+XRRModeInfo *resources_find_mode(const struct resources *res, RRMode mode);
+struct output_info *resources_find_output(const struct resources *res,
+					  RROutput output);
+struct crtc_info *resources_find_crtc(const struct resources *res,
+				      RRCrtc crtc);
+struct resources *resources_read_lock(void);
+void resources_read_unlock(void);
+void resources_publish(struct resources *res);
+void resources_reclaim(void);
+int resources_mode_index(const struct resources *res,
+			 const XRRModeInfo *mode_info);
+
+/* mode-table.c */
+struct mode_metrics {
+	double refresh;
+	double hfreq;
+	double blanking;
+	double bandwidth;
+};
+
+void mode_table_set(struct mode_table *t, int k, const XRRModeInfo *mode_info);
+void mode_table_compute(struct mode_table *t);
+void mode_metrics_get(const struct resources *res, const XRRModeInfo *mode_info,
+		      struct mode_metrics *m);
+guint mode_timing_hash(gconstpointer key);
+gboolean mode_timing_equal(gconstpointer a, gconstpointer b);
+
+/* randr-xcb.c */
+/* what a CRTC is to show, see crtcs_configure() */
+struct crtc_change {
+	RRCrtc crtc;
+	RRMode mode;		/* None turns the CRTC off */
+	int x, y;
+	Rotation rotation;
+	int noutput;
+	RROutput *outputs;
+};
+
+struct resources *resources_get(xcb_connection_t *c, xcb_window_t root,
+				int probe);
+struct resources *resources_update(xcb_connection_t *c, xcb_window_t root,
+				   const struct resources *res,
+				   const RROutput *outputs, int noutput,
+				   const RRCrtc *crtcs, int ncrtc,
+				   const XRRModeInfo *modes, int nmode);
+xcb_window_t screen_root(xcb_connection_t *c, int screen);
+GBytes *output_edid_get(xcb_connection_t *c, const struct resources *res,
+			const struct output_info *output_info);
+GBytes *output_edid_peek(const struct output_info *output_info,
+			 gboolean *complete);
+int crtc_set_mode(xcb_connection_t *c, Time config_timestamp, RRCrtc crtc,
+		  RROutput output, RRMode mode);
+int crtcs_set_modes(xcb_connection_t *c, Time config_timestamp,
+		    const RRCrtc *crtcs, const RROutput *outputs,
+		    const RRMode *modes, int n);
+int crtcs_configure(xcb_connection_t *c, xcb_window_t root,
+		    const struct resources *res,
+		    const struct crtc_change *changes, int n);
+int output_modes_add(xcb_connection_t *c, xcb_window_t root,
+		     const struct resources *res, RROutput output,
+		     XRRModeInfo *modes, int nmode);
+int output_modes_prune(xcb_connection_t *c, const struct resources *res,
+		       RROutput output, const XRRModeInfo *keep, int nkeep);
+
+/* apply.c */
+/* skipped if mode was active already, nothing was sent then */
+typedef void (*apply_done_func)(RROutput output, RRMode mode, int status,
+				gboolean skipped, gint64 reply_time,
+				gpointer user_data);
+
+/* set the mode even if the snapshot says it is active already */
+#define APPLY_FORCE	(1 << 0)
+
+void apply_init(const char *display_name);
+void apply_mode(RROutput output, RRMode mode, unsigned int flags,
+		apply_done_func done, gpointer user_data);
+struct transaction *transaction_new(void);
+void transaction_set(struct transaction *t, RROutput output, RRMode mode,
+		     int x, int y);
+void transaction_commit(struct transaction *t, apply_done_func done,
+			gpointer user_data);
+
+/* clone.c */
+GArray *clone_modes(const struct resources *res, const RROutput *outputs,
+		    int noutput);
+RRMode clone_mode_for(const struct resources *res,
+		      const struct output_info *output_info, int index);
+
+/* drm-sysfs.c */
+struct resources *resources_get_sysfs(const char *root);
+int drm_sysfs_list(const char *root);
+
+/* edid.c */
+#define EDID_BLOCK_SIZE 128
+
+/* points into the EDID, not NUL terminated */
+struct edid_string {
+	const char *data;
+	int len;
+};
+
+struct edid_timing {
+	unsigned int pixclock;	/* kHz */
+	unsigned int hactive, hblank, hsync_offset, hsync_width;
+	unsigned int vactive, vblank, vsync_offset, vsync_width;
+	unsigned int width_mm, height_mm;
+	unsigned char flags;	/* interlace, stereo and sync bits */
+};
+
+struct edid_range {
+	unsigned int min_vfreq, max_vfreq;	/* Hz */
+	unsigned int min_hfreq, max_hfreq;	/* kHz */
+	unsigned int max_pixclock;		/* kHz, 0 if not given */
+};
+
+struct edid_info {
+	char vendor[4];		/* PNP ID */
+	unsigned int product;
+	guint32 serial;
+	unsigned int week;	/* 0xff: year is the model year */
+	unsigned int year;
+	unsigned int version, revision;
+	unsigned int width_cm, height_cm;
+	int checksum_ok;
+	int nextension;
+	struct edid_string name;
+	struct edid_string serial_string;
+	struct edid_string text;
+	int has_range;
+	struct edid_range range;
+	int ntiming;
+	struct edid_timing timings[4];
+};
+
+void edid_timing_decode(const unsigned char *d, struct edid_timing *t);
+int edid_decode(const unsigned char *edid, unsigned long length,
+		struct edid_info *info);
+void edid_string_copy(const struct edid_string *s, char *buf, size_t size);
+unsigned char edid_block_checksum(const unsigned char *block);
+
+/* cea.c */
+struct cea_vic {
+	unsigned int pixclock;	/* kHz */
+	unsigned short hactive, hsync_start, hsync_end, htotal;
+	unsigned short vactive, vsync_start, vsync_end, vtotal;
+	unsigned int flags;	/* RR_* mode flags */
+};
+
+#define CEA_MAX_SVD 64
+
+enum {
+	CEA_YCBCR420_NONE,
+	CEA_YCBCR420_ALSO,
+	CEA_YCBCR420_ONLY,
+};
+
+struct cea_svd {
+	unsigned char vic;
+	unsigned char native;
+	unsigned char ycbcr420;
+};
+
+struct edid_cea {
+	int revision;
+	int underscan;
+	int hdmi;
+	int hdmi_forum;
+	unsigned int max_tmds;		/* kHz, 0 if not given */
+	unsigned int max_tmds_hf;	/* kHz, 0 if not given */
+	int nsvd;
+	struct cea_svd svds[CEA_MAX_SVD];
+	int ndtd;
+	struct edid_timing dtds[6];
+};
+
+const struct cea_vic *cea_vic_get(unsigned int vic);
+char *cea_summary(const struct edid_cea *cea);
+void cea_vic_mode_info(const struct cea_vic *vic, XRRModeInfo *mode_info);
+int edid_cea_decode(const unsigned char *edid, unsigned long length,
+		    struct edid_cea *cea);
+
+/* displayid.c */
+struct displayid_iter {
+	const unsigned char *edid;
+	unsigned long length;
+	unsigned long block;
+	int version;
+	int offset, end;	/* of the current section in the block */
+};
+
+struct displayid_timing {
+	unsigned int pixclock;	/* kHz */
+	unsigned int hactive, hblank, hsync_offset, hsync_width;
+	unsigned int vactive, vblank, vsync_offset, vsync_width;
+	unsigned char hsync_positive, vsync_positive;
+	unsigned char interlaced;
+	unsigned char preferred;
+};
+
+struct displayid_tile {
+	int num_h, num_v;
+	int h_loc, v_loc;
+	unsigned int width, height;
+	int single_enclosure;
+	unsigned char topology_id[8];
+};
+
+struct edid_displayid {
+	int version;		/* BCD, 0x13 or 0x20 */
+	int ntiming;
+	struct displayid_timing timings[16];
+	int has_tile;
+	struct displayid_tile tile;
+};
+
+void displayid_iter_init(struct displayid_iter *iter,
+			 const unsigned char *edid, unsigned long length);
+const unsigned char *displayid_iter_next(struct displayid_iter *iter,
+					 int *tag, int *len);
+int edid_displayid_decode(const unsigned char *edid, unsigned long length,
+			  struct edid_displayid *did);
+void displayid_timing_mode_info(const struct displayid_timing *t,
+				XRRModeInfo *mode_info);
+char *displayid_summary(const struct edid_displayid *did);
+
+/* edid.c, interning */
+
+/*
+ * Pseudo XIDs for advertised modes, the low bits are the VIC or the index
+ * of the DisplayID timing. Real XIDs never have any of the top three bits
+ * set.
+ */
+#define ADVERTISED_XID 0x40000000
+#define ADVERTISED_DISPLAYID 0x00010000
+#define ADVERTISED_INDEX 0x0000ffff
+
+struct edid_record {
+	int ref;
+	GBytes *bytes;		/* complete EDID, decoded strings point here */
+	guint hash;
+	struct edid_info info;
+	char name[14];		/* monitor name, NUL terminated */
+	int has_cea;
+	struct edid_cea cea;
+	int has_displayid;
+	struct edid_displayid displayid;
+	char *summary;		/* CEA and DisplayID, NULL if neither */
+	GArray *modes;		/* XRRModeInfo with ADVERTISED_XID ids */
+};
+
+struct edid_record *edid_intern(GBytes *edid);
+void edid_record_unref(struct edid_record *record);
+const char *edid_mode_check(const struct edid_record *record,
+			    const XRRModeInfo *mode_info, gboolean tmds);
+
+/* inspect.c */
+int inspect_run(char **paths);
+
+/* latency.c */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NBUCKET ((32 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+struct histogram {
+	guint64 count;
+	guint32 min, max;
+	guint32 buckets[HISTOGRAM_NBUCKET];
+};
+
+struct latency {
+	char *output;
+	char *monitor;
+	struct histogram reply;		/* request to RandR reply */
+	struct histogram notify;	/* request to RRCrtcChangeNotify */
+};
+
+void histogram_record(struct histogram *h, gint64 value);
+guint32 histogram_percentile(const struct histogram *h, double p);
+struct latency *latency_get(const char *output, const char *monitor);
+char *latency_summary(const struct latency *latency);
+void latency_dump(FILE *f);
+void json_string(FILE *f, const char *str);
+
+/* link.c */
+enum link_kind {
+	LINK_TMDS,		/* limit is the TMDS clock in Hz */
+	LINK_RATE,		/* limit is the payload in bit/s */
+};
+
+struct link_profile {
+	char name[32];
+	enum link_kind kind;
+	double limit;
+	int bpc;
+};
+
+void link_init(const char *config);
+int link_count(void);
+const struct link_profile *link_get(int k);
+const struct link_profile *link_find(const char *name);
+double link_load(const struct link_profile *link, double dot_clock);
+int link_fits(const struct link_profile *link, const XRRModeInfo *mode_info);
+
+/* timing.c */
+enum timing_method {
+	TIMING_CVT,
+	TIMING_CVT_RB,
+	TIMING_CVT_RB2,
+	TIMING_GTF,
+};
+
+const char *timing_method_name(enum timing_method method);
+int timing_method_parse(const char *name, enum timing_method *method);
+int timing_generate(enum timing_method method, unsigned int width,
+		    unsigned int height, double refresh,
+		    XRRModeInfo *mode_info);
+const char *timing_validate(const XRRModeInfo *mode_info);
+int timing_generated(const XRRModeInfo *mode_info);
+int timing_spec_parse(const char *spec, unsigned int *width,
+		      unsigned int *height, double *refresh,
+		      enum timing_method *method);
+void timing_modeline_print(FILE *f, const XRRModeInfo *mode_info);
+int timing_print(char **specs);
+
+/* sweep.c */
+struct sweep_result {
+	int index;		/* in the mode list of the output */
+	RRMode mode;
+	char *name;
+	unsigned int width, height;
+	double refresh;
+	int status;
+	gint64 latency;		/* request to RandR reply, microseconds */
+};
+
+typedef void (*sweep_done_func)(RROutput output, GArray *results,
+				gpointer user_data);
+
+/* why mode_info must be left out, NULL if it may be applied */
+typedef const char *(*sweep_check_func)(const XRRModeInfo *mode_info,
+					gpointer user_data);
+
+int sweep_start(const struct resources *res, RROutput output,
+		sweep_check_func check, gpointer check_data,
+		sweep_done_func done, gpointer user_data);
+void sweep_write_csv(FILE *f, const char *output, GArray *results);
+void sweep_write_json(FILE *f, const char *output, GArray *results);
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * inspect.c
+ *
+ * Offline EDID inspection: validate and decode a corpus of raw EDID
+ * dumps without an X server and print one summary line per file.
+ *
+ * Files are split evenly across one worker per processor. A worker that
+ * runs dry steals the upper half of the largest range left, so a few
+ * slow directories on NFS do not hold up the rest.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+struct worker {
+	GMutex lock;
+	unsigned int lo, hi;	/* files left to do */
+	struct inspect *inspect;
+};
+
+struct inspect {
+	GPtrArray *paths;
+	char **lines;		/* result per file */
+	gint invalid;
+	int nworker;
+	struct worker *workers;
+};
+
+static void paths_collect(GPtrArray *paths, const char *path)
+{
+	GDir *dir;
+	const char *name;
+
+	if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
+		g_ptr_array_add(paths, g_strdup(path));
+		return;
+	}
+
+	dir = g_dir_open(path, 0, NULL);
+	if (!dir)
+		return;
+
+	while ((name = g_dir_read_name(dir))) {
+		char *child = g_build_filename(path, name, NULL);
+
+		/* symlinked directories could lead around in circles */
+		if (!g_file_test(child, G_FILE_TEST_IS_SYMLINK) ||
+		    !g_file_test(child, G_FILE_TEST_IS_DIR))
+			paths_collect(paths, child);
+		g_free(child);
+	}
+	g_dir_close(dir);
+}
+
+static gint path_cmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* one line: path, verdict, then whatever could be decoded */
+static char *inspect_file(const char *path, int *valid)
+{
+	GString *s = g_string_new(path);
+	struct edid_info info;
+	struct edid_cea cea;
+	struct edid_displayid did;
+	char name[14];
+	unsigned char *edid;
+	gsize length;
+	gsize k;
+	int bad = 0;
+
+	*valid = 0;
+
+	if (!g_file_get_contents(path, (char **)&edid, &length, NULL)) {
+		g_string_append(s, "\tunreadable");
+		return g_string_free(s, FALSE);
+	}
+
+	if (length < EDID_BLOCK_SIZE || length % EDID_BLOCK_SIZE) {
+		g_string_append_printf(s, "\tlength %" G_GSIZE_FORMAT,
+				       length);
+		goto out;
+	}
+
+	if (edid_decode(edid, length, &info)) {
+		g_string_append(s, "\theader");
+		goto out;
+	}
+
+	g_string_append_c(s, '\t');
+	for (k = 0; k < length / EDID_BLOCK_SIZE; ++k) {
+		if (edid_block_checksum(edid + k * EDID_BLOCK_SIZE)) {
+			g_string_append_printf(s, "%schecksum %" G_GSIZE_FORMAT,
+					       bad++ ? "," : "", k);
+		}
+	}
+	if (info.nextension != length / EDID_BLOCK_SIZE - 1)
+		g_string_append_printf(s, "%sextensions %d/%" G_GSIZE_FORMAT,
+				       bad++ ? "," : "", info.nextension,
+				       length / EDID_BLOCK_SIZE - 1);
+	if (!bad) {
+		g_string_append(s, "ok");
+		*valid = 1;
+	}
+
+	edid_string_copy(&info.name, name, sizeof(name));
+	g_string_append_printf(s, "\t%s\t%04x\t%s\t%u.%u\t%u/%u",
+			       info.vendor, info.product, name, info.version,
+			       info.revision, info.week, info.year);
+
+	if (!edid_cea_decode(edid, length, &cea)) {
+		char *text = cea_summary(&cea);
+
+		g_strdelimit(text, "\n", ';');
+		g_string_append_printf(s, "\t%s, %d SVDs", text, cea.nsvd);
+		g_free(text);
+	}
+
+	if (!edid_displayid_decode(edid, length, &did)) {
+		char *text = displayid_summary(&did);
+
+		g_string_append_printf(s, "\t%s, %d timings", text,
+				       did.ntiming);
+		g_free(text);
+	}
+
+out:
+	g_free(edid);
+
+	return g_string_free(s, FALSE);
+}
+
+static int worker_take(struct worker *worker, unsigned int *index)
+{
+	int found = 0;
+
+	g_mutex_lock(&worker->lock);
+	if (worker->lo < worker->hi) {
+		*index = worker->lo++;
+		found = 1;
+	}
+	g_mutex_unlock(&worker->lock);
+
+	return found;
+}
+
+/* move the upper half of the fullest range over to self */
+static int worker_steal(struct worker *self)
+{
+	struct inspect *inspect = self->inspect;
+	struct worker *victim = NULL;
+	unsigned int most = 0;
+	unsigned int lo, hi;
+	int k;
+
+	for (k = 0; k < inspect->nworker; ++k) {
+		struct worker *w = &inspect->workers[k];
+		unsigned int left;
+
+		if (w == self)
+			continue;
+
+		g_mutex_lock(&w->lock);
+		left = w->hi - w->lo;
+		g_mutex_unlock(&w->lock);
+
+		if (left > most) {
+			most = left;
+			victim = w;
+		}
+	}
+
+	if (!victim)
+		return 0;
+
+	g_mutex_lock(&victim->lock);
+	hi = victim->hi;
+	lo = hi - (hi - victim->lo + 1) / 2;
+	victim->hi = lo;
+	g_mutex_unlock(&victim->lock);
+
+	/* the victim may have finished its range in the meantime */
+	if (lo == hi)
+		return 1;
+
+	g_mutex_lock(&self->lock);
+	self->lo = lo;
+	self->hi = hi;
+	g_mutex_unlock(&self->lock);
+
+	return 1;
+}
+
+static gpointer worker_thread(gpointer data)
+{
+	struct worker *worker = data;
+	struct inspect *inspect = worker->inspect;
+	unsigned int index;
+
+	do {
+		while (worker_take(worker, &index)) {
+			int valid;
+
+			inspect->lines[index] =
+			    inspect_file(g_ptr_array_index(inspect->paths,
+							   index), &valid);
+			if (!valid)
+				g_atomic_int_inc(&inspect->invalid);
+		}
+	} while (worker_steal(worker));
+
+	return NULL;
+}
+
+/*
+ * Inspect all files below paths and print the results to stdout in
+ * path order. Returns the process exit status: 0 if all files are valid.
+ */
+int inspect_run(char **paths)
+{
+	struct inspect inspect = { 0 };
+	GThread **threads;
+	unsigned int n;
+	int k;
+
+	inspect.paths = g_ptr_array_new_with_free_func(g_free);
+	for (; *paths; ++paths)
+		paths_collect(inspect.paths, *paths);
+	g_ptr_array_sort(inspect.paths, path_cmp);
+	n = inspect.paths->len;
+
+	inspect.lines = g_new0(char *, n);
+	inspect.nworker = CLAMP(g_get_num_processors(), 1, MAX(n, 1));
+	inspect.workers = g_new0(struct worker, inspect.nworker);
+	threads = g_new(GThread *, inspect.nworker);
+
+	for (k = 0; k < inspect.nworker; ++k) {
+		struct worker *worker = &inspect.workers[k];
+
+		g_mutex_init(&worker->lock);
+		worker->lo = (guint64)n * k / inspect.nworker;
+		worker->hi = (guint64)n * (k + 1) / inspect.nworker;
+		worker->inspect = &inspect;
+	}
+
+	for (k = 0; k < inspect.nworker; ++k)
+		threads[k] = g_thread_new("inspect", worker_thread,
+					  &inspect.workers[k]);
+	for (k = 0; k < inspect.nworker; ++k)
+		g_thread_join(threads[k]);
+
+	for (k = 0; k < n; ++k) {
+		puts(inspect.lines[k]);
+		g_free(inspect.lines[k]);
+	}
+
+	fprintf(stderr, "%u files, %d invalid\n", n, inspect.invalid);
+
+	for (k = 0; k < inspect.nworker; ++k)
+		g_mutex_clear(&inspect.workers[k].lock);
+	g_free(threads);
+	g_free(inspect.workers);
+	g_free(inspect.lines);
+	g_ptr_array_free(inspect.paths, TRUE);
+
+	return inspect.invalid ? 1 : 0;
+}
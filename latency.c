@@ -0,0 +1,210 @@
+/*
+ * latency.c
+ *
+ * Mode switch latency statistics. Every output and monitor combination
+ * keeps a histogram of the time to the RandR reply and one of the time
+ * to the matching RRCrtcChangeNotify.
+ *
+ * The histograms are HDR style: values below 2 * HISTOGRAM_SUB are
+ * counted exactly, above that every power of two is split into
+ * HISTOGRAM_SUB buckets, so the relative error stays below 1/16 while
+ * recording is a couple of shifts.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+static unsigned int histogram_bucket(guint32 value)
+{
+	int shift;
+
+	if (value < 2 * HISTOGRAM_SUB)
+		return value;
+
+	shift = g_bit_nth_msf(value, -1) - HISTOGRAM_SUB_BITS;
+
+	return (shift + 1) * HISTOGRAM_SUB + (value >> shift) - HISTOGRAM_SUB;
+}
+
+/* highest value counted in bucket */
+static guint32 histogram_value(unsigned int bucket)
+{
+	int shift;
+	guint32 top;
+
+	if (bucket < 2 * HISTOGRAM_SUB)
+		return bucket;
+
+	shift = bucket / HISTOGRAM_SUB - 1;
+	top = bucket % HISTOGRAM_SUB + HISTOGRAM_SUB;
+
+	return (((guint64)top + 1) << shift) - 1;
+}
+
+/* value in microseconds, anything beyond an hour is clamped */
+void histogram_record(struct histogram *h, gint64 value)
+{
+	guint32 v;
+
+	if (value < 0)
+		value = 0;
+	v = MIN(value, G_MAXUINT32);
+
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->buckets[histogram_bucket(v)]++;
+}
+
+/* p in percent, the result is exact to within the bucket width */
+guint32 histogram_percentile(const struct histogram *h, double p)
+{
+	guint64 rank;
+	guint64 seen = 0;
+	unsigned int k;
+
+	if (!h->count)
+		return 0;
+
+	rank = (guint64)(p / 100.0 * h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > h->count)
+		rank = h->count;
+
+	for (k = 0; k < HISTOGRAM_NBUCKET; ++k) {
+		seen += h->buckets[k];
+		if (seen >= rank)
+			return MIN(histogram_value(k), h->max);
+	}
+
+	return h->max;
+}
+
+/*
+ * Statistics outlive tabs, so they are kept by output and monitor name
+ * for the lifetime of the process.
+ */
+static GHashTable *latencies;	/* "output\nmonitor" -> struct latency */
+static GPtrArray *order;	/* in order of appearance, for dumping */
+
+struct latency *latency_get(const char *output, const char *monitor)
+{
+	struct latency *latency;
+	char *key;
+
+	if (!latencies) {
+		latencies = g_hash_table_new_full(g_str_hash, g_str_equal,
+						  g_free, NULL);
+		order = g_ptr_array_new();
+	}
+
+	key = g_strdup_printf("%s\n%s", output, monitor);
+	latency = g_hash_table_lookup(latencies, key);
+	if (latency) {
+		g_free(key);
+		return latency;
+	}
+
+	latency = g_new0(struct latency, 1);
+	latency->output = g_strdup(output);
+	latency->monitor = g_strdup(monitor);
+	g_hash_table_insert(latencies, key, latency);
+	g_ptr_array_add(order, latency);
+
+	return latency;
+}
+
+static void summary_append(GString *s, const char *what,
+			   const struct histogram *h)
+{
+	if (!h->count) {
+		g_string_append_printf(s, "%s: no samples", what);
+		return;
+	}
+
+	g_string_append_printf(s,
+			       "%s: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms "
+			       "(%" G_GUINT64_FORMAT " samples)", what,
+			       histogram_percentile(h, 50) / 1000.0,
+			       histogram_percentile(h, 95) / 1000.0,
+			       histogram_percentile(h, 99) / 1000.0,
+			       h->count);
+}
+
+/* human readable, for tooltips; g_free() the result */
+char *latency_summary(const struct latency *latency)
+{
+	GString *s = g_string_new(NULL);
+
+	summary_append(s, "Reply", &latency->reply);
+	g_string_append_c(s, '\n');
+	summary_append(s, "Notify", &latency->notify);
+
+	return g_string_free(s, FALSE);
+}
+
+/* the output is UTF-8, so only control characters need escaping */
+void json_string(FILE *f, const char *str)
+{
+	const unsigned char *p;
+
+	fputc('"', f);
+	for (p = (const unsigned char *)str; *p; ++p) {
+		if (*p == '"' || *p == '\\')
+			fprintf(f, "\\%c", *p);
+		else if (*p < 0x20 || *p == 0x7f)
+			fprintf(f, "\\u%04x", *p);
+		else
+			fputc(*p, f);
+	}
+	fputc('"', f);
+}
+
+static void json_histogram(FILE *f, const struct histogram *h)
+{
+	fprintf(f, "{\"count\": %" G_GUINT64_FORMAT, h->count);
+	if (h->count)
+		fprintf(f, ", \"min_us\": %u, \"p50_us\": %u, \"p95_us\": %u"
+			", \"p99_us\": %u, \"max_us\": %u", h->min,
+			histogram_percentile(h, 50),
+			histogram_percentile(h, 95),
+			histogram_percentile(h, 99), h->max);
+	fputc('}', f);
+}
+
+/* all statistics as a JSON document */
+void latency_dump(FILE *f)
+{
+	unsigned int k;
+
+	fputs("{\"latency\": [", f);
+	for (k = 0; order && k < order->len; ++k) {
+		struct latency *latency = g_ptr_array_index(order, k);
+
+		fputs(k ? ",\n  {" : "\n  {", f);
+		fputs("\"output\": ", f);
+		json_string(f, latency->output);
+		fputs(", \"monitor\": ", f);
+		json_string(f, latency->monitor);
+		fputs(", \"reply\": ", f);
+		json_histogram(f, &latency->reply);
+		fputs(", \"notify\": ", f);
+		json_histogram(f, &latency->notify);
+		fputc('}', f);
+	}
+	fputs("\n]}\n", f);
+}
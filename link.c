@@ -0,0 +1,201 @@
+/*
+ * link.c
+ *
+ * Link profiles: the data rate ceiling of an HDMI or DisplayPort link,
+ * an extender or a KVM path, and whether a mode fits through it. Besides
+ * the standard link rates, profiles can be read from a key file, one
+ * group per profile:
+ *
+ *   [KVM extender]
+ *   type=dp		dp, hdmi or rate
+ *   rate=hbr2		dp: rbr, hbr, hbr2 or hbr3
+ *   lanes=2		dp: 1, 2 or 4
+ *   max-tmds=300	hdmi: TMDS clock in MHz
+ *   max-rate=6.5	rate: payload in Gbit/s
+ *   bpc=8		bits per color component, 8 if not given
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+/* DisplayPort 1.x lanes use 8b/10b coding */
+#define DP_PAYLOAD(gbps, lanes) ((gbps) * 1e9 * 0.8 * (lanes))
+
+static const struct link_profile builtin[] = {
+	{ "HDMI 1.4", LINK_TMDS, 340e6, 8 },
+	{ "HDMI 2.0", LINK_TMDS, 600e6, 8 },
+	{ "DP HBR x1", LINK_RATE, DP_PAYLOAD(2.7, 1), 8 },
+	{ "DP HBR x2", LINK_RATE, DP_PAYLOAD(2.7, 2), 8 },
+	{ "DP HBR x4", LINK_RATE, DP_PAYLOAD(2.7, 4), 8 },
+	{ "DP HBR2 x1", LINK_RATE, DP_PAYLOAD(5.4, 1), 8 },
+	{ "DP HBR2 x2", LINK_RATE, DP_PAYLOAD(5.4, 2), 8 },
+	{ "DP HBR2 x4", LINK_RATE, DP_PAYLOAD(5.4, 4), 8 },
+	{ "DP HBR3 x1", LINK_RATE, DP_PAYLOAD(8.1, 1), 8 },
+	{ "DP HBR3 x2", LINK_RATE, DP_PAYLOAD(8.1, 2), 8 },
+	{ "DP HBR3 x4", LINK_RATE, DP_PAYLOAD(8.1, 4), 8 },
+};
+
+static const struct {
+	const char *name;
+	double gbps;
+} dp_rates[] = {
+	{ "rbr", 1.62 },
+	{ "hbr", 2.7 },
+	{ "hbr2", 5.4 },
+	{ "hbr3", 8.1 },
+};
+
+static GArray *profiles;	/* struct link_profile */
+
+static int dp_parse(GKeyFile *kf, const char *group,
+		    struct link_profile *link)
+{
+	char *rate = g_key_file_get_string(kf, group, "rate", NULL);
+	int lanes = g_key_file_get_integer(kf, group, "lanes", NULL);
+	unsigned int k;
+
+	if (!rate)
+		return -1;
+	if (lanes != 1 && lanes != 2 && lanes != 4)
+		lanes = 4;
+
+	for (k = 0; k < G_N_ELEMENTS(dp_rates); ++k) {
+		if (!g_ascii_strcasecmp(rate, dp_rates[k].name))
+			break;
+	}
+	g_free(rate);
+	if (k == G_N_ELEMENTS(dp_rates))
+		return -1;
+
+	link->kind = LINK_RATE;
+	link->limit = DP_PAYLOAD(dp_rates[k].gbps, lanes);
+
+	return 0;
+}
+
+static int profile_parse(GKeyFile *kf, const char *group,
+			 struct link_profile *link)
+{
+	char *type = g_key_file_get_string(kf, group, "type", NULL);
+	int ret = -1;
+
+	memset(link, 0, sizeof(*link));
+	g_strlcpy(link->name, group, sizeof(link->name));
+	link->bpc = 8;
+	if (g_key_file_has_key(kf, group, "bpc", NULL))
+		link->bpc = g_key_file_get_integer(kf, group, "bpc", NULL);
+
+	if (!type || link->bpc < 6 || link->bpc > 16)
+		goto out;
+
+	if (!strcmp(type, "dp")) {
+		ret = dp_parse(kf, group, link);
+	} else if (!strcmp(type, "hdmi")) {
+		link->kind = LINK_TMDS;
+		link->limit = g_key_file_get_double(kf, group, "max-tmds",
+						    NULL) * 1e6;
+		ret = link->limit > 0 ? 0 : -1;
+	} else if (!strcmp(type, "rate")) {
+		link->kind = LINK_RATE;
+		link->limit = g_key_file_get_double(kf, group, "max-rate",
+						    NULL) * 1e9;
+		ret = link->limit > 0 ? 0 : -1;
+	}
+
+out:
+	g_free(type);
+
+	return ret;
+}
+
+/*
+ * Set up the standard profiles and those from config, which may be
+ * NULL. A missing config file is fine, broken profiles are skipped with
+ * a warning.
+ */
+void link_init(const char *config)
+{
+	GKeyFile *kf;
+	GError *error = NULL;
+	char **groups;
+	gsize k, n;
+
+	profiles = g_array_new(FALSE, FALSE, sizeof(struct link_profile));
+	g_array_append_vals(profiles, builtin, G_N_ELEMENTS(builtin));
+
+	if (!config)
+		return;
+
+	kf = g_key_file_new();
+	if (!g_key_file_load_from_file(kf, config, G_KEY_FILE_NONE, &error)) {
+		if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_warning("%s: %s\n", config, error->message);
+		g_error_free(error);
+		g_key_file_free(kf);
+		return;
+	}
+
+	groups = g_key_file_get_groups(kf, &n);
+	for (k = 0; k < n; ++k) {
+		struct link_profile link;
+
+		if (profile_parse(kf, groups[k], &link)) {
+			g_warning("%s: link profile [%s] is incomplete\n",
+				  config, groups[k]);
+			continue;
+		}
+		g_array_append_val(profiles, link);
+	}
+	g_strfreev(groups);
+	g_key_file_free(kf);
+}
+
+int link_count(void)
+{
+	return profiles ? profiles->len : 0;
+}
+
+const struct link_profile *link_get(int k)
+{
+	return &g_array_index(profiles, struct link_profile, k);
+}
+
+const struct link_profile *link_find(const char *name)
+{
+	int k;
+
+	for (k = 0; k < link_count(); ++k) {
+		if (!strcmp(link_get(k)->name, name))
+			return link_get(k);
+	}
+
+	return NULL;
+}
+
+/*
+ * Share of the link a mode with dot_clock (Hz) takes, above 1 if it does
+ * not fit. Deep color raises the TMDS clock by bpc/8, a DisplayPort
+ * stream takes three components per pixel.
+ */
+double link_load(const struct link_profile *link, double dot_clock)
+{
+	if (link->kind == LINK_TMDS)
+		return dot_clock * link->bpc / 8 / link->limit;
+
+	return dot_clock * link->bpc * 3 / link->limit;
+}
+
+int link_fits(const struct link_profile *link, const XRRModeInfo *mode_info)
+{
+	return link_load(link, mode_info->dotClock) <= 1.0;
+}
@@ -0,0 +1,531 @@
+/*
+ * mode-model.c
+ *
+ * GtkTreeModel listing the modes of one output. Rows only point to the
+ * XRRModeInfo entries of the current resources, all text is formatted by
+ * the view for the rows it actually draws.
+ *
+ * There is one row per timing. Further modes with the same timing, which
+ * some drivers expose under other names, are its children.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <gtk/gtk.h>
+
+#include "gresolutions.h"
+#include "mode-model.h"
+
+struct mode_row {
+	XRRModeInfo *mode_info;	/* first mode of the timing */
+	gboolean preferred;	/* any of the modes is */
+	GPtrArray *aliases;	/* XRRModeInfo, the other modes */
+};
+
+struct _ModeModel {
+	GObject parent_instance;
+	gint stamp;
+	GArray *rows;
+};
+
+static void mode_model_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(ModeModel, mode_model, G_TYPE_OBJECT,
+			G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL,
+					      mode_model_tree_model_init))
+
+static struct mode_row *row_get(ModeModel *model, int index)
+{
+	return &g_array_index(model->rows, struct mode_row, index);
+}
+
+/* alias -1 is the row itself */
+static void iter_set(ModeModel *model, GtkTreeIter *iter, int index,
+		     int alias)
+{
+	iter->stamp = model->stamp;
+	iter->user_data = GINT_TO_POINTER(index);
+	iter->user_data2 = GINT_TO_POINTER(alias + 1);
+}
+
+static int iter_index(GtkTreeIter *iter)
+{
+	return GPOINTER_TO_INT(iter->user_data);
+}
+
+static int iter_alias(GtkTreeIter *iter)
+{
+	return GPOINTER_TO_INT(iter->user_data2) - 1;
+}
+
+static GtkTreePath *path_new(int index, int alias)
+{
+	if (alias < 0)
+		return gtk_tree_path_new_from_indices(index, -1);
+
+	return gtk_tree_path_new_from_indices(index, alias, -1);
+}
+
+static GtkTreeModelFlags mode_model_get_flags(GtkTreeModel *tree_model)
+{
+	return 0;
+}
+
+static gint mode_model_get_n_columns(GtkTreeModel *tree_model)
+{
+	return N_COLUMNS;
+}
+
+static GType mode_model_get_column_type(GtkTreeModel *tree_model,
+					gint index)
+{
+	switch (index) {
+	case XID_COLUMN:
+		return G_TYPE_INT;
+	case PREFERRED_COLUMN:
+		return G_TYPE_BOOLEAN;
+	case MODE_COLUMN:
+		return G_TYPE_POINTER;
+	}
+
+	return G_TYPE_INVALID;
+}
+
+static gboolean mode_model_get_iter(GtkTreeModel *tree_model,
+				    GtkTreeIter *iter, GtkTreePath *path)
+{
+	ModeModel *model = MODE_MODEL(tree_model);
+	int depth = gtk_tree_path_get_depth(path);
+	int *indices = gtk_tree_path_get_indices(path);
+	int alias = -1;
+
+	if (depth < 1 || depth > 2)
+		return FALSE;
+	if (indices[0] < 0 || indices[0] >= model->rows->len)
+		return FALSE;
+
+	if (depth == 2) {
+		alias = indices[1];
+		if (alias < 0 || alias >= row_get(model, indices[0])->aliases->len)
+			return FALSE;
+	}
+
+	iter_set(model, iter, indices[0], alias);
+
+	return TRUE;
+}
+
+static GtkTreePath *mode_model_get_path(GtkTreeModel *tree_model,
+					GtkTreeIter *iter)
+{
+	return path_new(iter_index(iter), iter_alias(iter));
+}
+
+static void mode_model_get_value(GtkTreeModel *tree_model, GtkTreeIter *iter,
+				 gint column, GValue *value)
+{
+	const XRRModeInfo *mode_info =
+	    mode_model_get_mode(MODE_MODEL(tree_model), iter);
+	struct mode_row *row = row_get(MODE_MODEL(tree_model),
+				       iter_index(iter));
+
+	g_value_init(value, mode_model_get_column_type(tree_model, column));
+
+	switch (column) {
+	case XID_COLUMN:
+		g_value_set_int(value, mode_info->id);
+		break;
+	case PREFERRED_COLUMN:
+		g_value_set_boolean(value, iter_alias(iter) < 0 &&
+				    row->preferred);
+		break;
+	case MODE_COLUMN:
+		g_value_set_pointer(value, (gpointer) mode_info);
+		break;
+	}
+}
+
+static gboolean mode_model_iter_next(GtkTreeModel *tree_model,
+				     GtkTreeIter *iter)
+{
+	ModeModel *model = MODE_MODEL(tree_model);
+	int index = iter_index(iter);
+	int alias = iter_alias(iter);
+
+	if (alias >= 0) {
+		if (alias + 1 >= row_get(model, index)->aliases->len)
+			return FALSE;
+		iter_set(model, iter, index, alias + 1);
+		return TRUE;
+	}
+
+	if (index + 1 >= model->rows->len)
+		return FALSE;
+
+	iter_set(model, iter, index + 1, -1);
+
+	return TRUE;
+}
+
+static gboolean mode_model_iter_previous(GtkTreeModel *tree_model,
+					 GtkTreeIter *iter)
+{
+	ModeModel *model = MODE_MODEL(tree_model);
+	int index = iter_index(iter);
+	int alias = iter_alias(iter);
+
+	if (alias >= 0) {
+		if (alias == 0)
+			return FALSE;
+		iter_set(model, iter, index, alias - 1);
+		return TRUE;
+	}
+
+	if (index == 0)
+		return FALSE;
+
+	iter_set(model, iter, index - 1, -1);
+
+	return TRUE;
+}
+
+static gboolean mode_model_iter_nth_child(GtkTreeModel *tree_model,
+					  GtkTreeIter *iter,
+					  GtkTreeIter *parent, gint n)
+{
+	ModeModel *model = MODE_MODEL(tree_model);
+
+	if (n < 0)
+		return FALSE;
+
+	if (!parent) {
+		if (n >= model->rows->len)
+			return FALSE;
+		iter_set(model, iter, n, -1);
+		return TRUE;
+	}
+
+	if (iter_alias(parent) >= 0 ||
+	    n >= row_get(model, iter_index(parent))->aliases->len)
+		return FALSE;
+
+	iter_set(model, iter, iter_index(parent), n);
+
+	return TRUE;
+}
+
+static gboolean mode_model_iter_children(GtkTreeModel *tree_model,
+					 GtkTreeIter *iter,
+					 GtkTreeIter *parent)
+{
+	return mode_model_iter_nth_child(tree_model, iter, parent, 0);
+}
+
+static gint mode_model_iter_n_children(GtkTreeModel *tree_model,
+				       GtkTreeIter *iter)
+{
+	ModeModel *model = MODE_MODEL(tree_model);
+
+	if (!iter)
+		return model->rows->len;
+	if (iter_alias(iter) >= 0)
+		return 0;
+
+	return row_get(model, iter_index(iter))->aliases->len;
+}
+
+static gboolean mode_model_iter_has_child(GtkTreeModel *tree_model,
+					  GtkTreeIter *iter)
+{
+	return mode_model_iter_n_children(tree_model, iter) > 0;
+}
+
+static gboolean mode_model_iter_parent(GtkTreeModel *tree_model,
+				       GtkTreeIter *iter, GtkTreeIter *child)
+{
+	if (iter_alias(child) < 0)
+		return FALSE;
+
+	iter_set(MODE_MODEL(tree_model), iter, iter_index(child), -1);
+
+	return TRUE;
+}
+
+static void mode_model_tree_model_init(GtkTreeModelIface *iface)
+{
+	iface->get_flags = mode_model_get_flags;
+	iface->get_n_columns = mode_model_get_n_columns;
+	iface->get_column_type = mode_model_get_column_type;
+	iface->get_iter = mode_model_get_iter;
+	iface->get_path = mode_model_get_path;
+	iface->get_value = mode_model_get_value;
+	iface->iter_next = mode_model_iter_next;
+	iface->iter_previous = mode_model_iter_previous;
+	iface->iter_children = mode_model_iter_children;
+	iface->iter_has_child = mode_model_iter_has_child;
+	iface->iter_n_children = mode_model_iter_n_children;
+	iface->iter_nth_child = mode_model_iter_nth_child;
+	iface->iter_parent = mode_model_iter_parent;
+}
+
+static void row_clear(gpointer data)
+{
+	struct mode_row *row = data;
+
+	g_ptr_array_free(row->aliases, TRUE);
+}
+
+static void mode_model_finalize(GObject *object)
+{
+	ModeModel *model = MODE_MODEL(object);
+
+	g_array_free(model->rows, TRUE);
+
+	G_OBJECT_CLASS(mode_model_parent_class)->finalize(object);
+}
+
+static void mode_model_class_init(ModeModelClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = mode_model_finalize;
+}
+
+static void mode_model_init(ModeModel *model)
+{
+	model->stamp = g_random_int();
+	model->rows = g_array_new(FALSE, FALSE, sizeof(struct mode_row));
+	g_array_set_clear_func(model->rows, row_clear);
+}
+
+ModeModel *mode_model_new(void)
+{
+	return g_object_new(MODE_TYPE_MODEL, NULL);
+}
+
+static void row_inserted(ModeModel *model, int index, int alias)
+{
+	GtkTreePath *path = path_new(index, alias);
+	GtkTreeIter iter;
+
+	iter_set(model, &iter, index, alias);
+	gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), path, &iter);
+	gtk_tree_path_free(path);
+}
+
+static void row_deleted(ModeModel *model, int index, int alias)
+{
+	GtkTreePath *path = path_new(index, alias);
+
+	gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+	gtk_tree_path_free(path);
+}
+
+static void row_changed(ModeModel *model, int index)
+{
+	GtkTreePath *path = path_new(index, -1);
+	GtkTreeIter iter;
+
+	iter_set(model, &iter, index, -1);
+	gtk_tree_model_row_changed(GTK_TREE_MODEL(model), path, &iter);
+	gtk_tree_path_free(path);
+}
+
+static void row_has_child_toggled(ModeModel *model, int index)
+{
+	GtkTreePath *path = path_new(index, -1);
+	GtkTreeIter iter;
+
+	iter_set(model, &iter, index, -1);
+	gtk_tree_model_row_has_child_toggled(GTK_TREE_MODEL(model), path,
+					     &iter);
+	gtk_tree_path_free(path);
+}
+
+static gboolean aliases_same(GPtrArray *a, GPtrArray *b)
+{
+	int k;
+
+	if (a->len != b->len)
+		return FALSE;
+
+	for (k = 0; k < a->len; ++k) {
+		const XRRModeInfo *ma = g_ptr_array_index(a, k);
+		const XRRModeInfo *mb = g_ptr_array_index(b, k);
+
+		if (ma->id != mb->id)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Give row index the aliases of group, which are taken over. Alias rows
+ * are few, so any change simply replaces all of them.
+ */
+static void aliases_update(ModeModel *model, int index,
+			   struct mode_row *group)
+{
+	struct mode_row *row = row_get(model, index);
+	gboolean had_child = row->aliases->len > 0;
+	int k;
+
+	if (aliases_same(row->aliases, group->aliases)) {
+		g_ptr_array_free(row->aliases, TRUE);
+		row->aliases = group->aliases;
+		return;
+	}
+
+	for (k = row->aliases->len - 1; k >= 0; --k) {
+		g_ptr_array_remove_index(row->aliases, k);
+		row_deleted(model, index, k);
+	}
+	g_ptr_array_free(row->aliases, TRUE);
+
+	/* no aliases while inserting, the view asks for them on its own */
+	row->aliases = g_ptr_array_new();
+	for (k = 0; k < group->aliases->len; ++k) {
+		g_ptr_array_add(row->aliases,
+				g_ptr_array_index(group->aliases, k));
+		row_inserted(model, index, k);
+	}
+	g_ptr_array_free(group->aliases, TRUE);
+
+	if (had_child != (row->aliases->len > 0))
+		row_has_child_toggled(model, index);
+}
+
+/* one group per timing in the order of the first mode of each */
+static GArray *groups_new(XRRModeInfo **mode_infos,
+			  const gboolean *preferred, int nmode)
+{
+	GArray *groups = g_array_new(FALSE, FALSE, sizeof(struct mode_row));
+	GHashTable *timings;	/* XRRModeInfo -> group index */
+	int n;
+
+	timings = g_hash_table_new(mode_timing_hash, mode_timing_equal);
+	for (n = 0; n < nmode; ++n) {
+		struct mode_row *group;
+		gpointer index;
+
+		if (g_hash_table_lookup_extended(timings, mode_infos[n], NULL,
+						 &index)) {
+			group = &g_array_index(groups, struct mode_row,
+					       GPOINTER_TO_INT(index));
+			group->preferred |= preferred[n];
+			g_ptr_array_add(group->aliases, mode_infos[n]);
+		} else {
+			struct mode_row new_group = {
+				.mode_info = mode_infos[n],
+				.preferred = preferred[n],
+				.aliases = g_ptr_array_new(),
+			};
+
+			g_hash_table_insert(timings, mode_infos[n],
+					    GINT_TO_POINTER(groups->len));
+			g_array_append_val(groups, new_group);
+		}
+	}
+	g_hash_table_destroy(timings);
+
+	return groups;
+}
+
+/*
+ * Turn the rows into the given modes with as few row inserts and removes
+ * as possible, so the view keeps its cursor and scroll position. Rows
+ * are keyed by the XID of the first mode of their timing. The timings
+ * behind a mode XID never change, so kept rows only get pointed to the
+ * new XRRModeInfo and need a redraw only if the preferred flag differs.
+ */
+void mode_model_update(ModeModel *model, XRRModeInfo **mode_infos,
+		       const gboolean *preferred, int nmode)
+{
+	GHashTable *old_xids, *new_xids;
+	GArray *groups = groups_new(mode_infos, preferred, nmode);
+	int index = 0;
+	int n;
+
+	old_xids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	new_xids = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for (n = 0; n < model->rows->len; ++n)
+		g_hash_table_add(old_xids,
+				 GUINT_TO_POINTER(row_get(model, n)->
+						  mode_info->id));
+
+	for (n = 0; n < groups->len; ++n)
+		g_hash_table_add(new_xids,
+				 GUINT_TO_POINTER(g_array_index
+						  (groups, struct mode_row,
+						   n).mode_info->id));
+
+	n = 0;
+	while (index < model->rows->len || n < groups->len) {
+		struct mode_row *row = index < model->rows->len ?
+		    row_get(model, index) : NULL;
+		struct mode_row *group = n < groups->len ?
+		    &g_array_index(groups, struct mode_row, n) : NULL;
+
+		if (row && group && row->mode_info->id == group->mode_info->id) {
+			/* row stays */
+			row->mode_info = group->mode_info;
+			if (row->preferred != group->preferred) {
+				row->preferred = group->preferred;
+				row_changed(model, index);
+			}
+			aliases_update(model, index, group);
+			index++;
+			n++;
+		} else if (row &&
+			   (!group ||
+			    !g_hash_table_contains(new_xids,
+						   GUINT_TO_POINTER(row->
+								    mode_info->
+								    id)) ||
+			    g_hash_table_contains(old_xids,
+						  GUINT_TO_POINTER(group->
+								   mode_info->
+								   id)))) {
+			/*
+			 * row is gone or moved; a moved row is inserted again
+			 * once its new position is reached
+			 */
+			g_hash_table_remove(old_xids,
+					    GUINT_TO_POINTER(row->mode_info->
+							     id));
+			g_array_remove_index(model->rows, index);
+			row_deleted(model, index, -1);
+		} else {
+			struct mode_row new_row = {
+				.mode_info = group->mode_info,
+				.preferred = group->preferred,
+				.aliases = g_ptr_array_new(),
+			};
+
+			g_array_insert_val(model->rows, index, new_row);
+			row_inserted(model, index, -1);
+			aliases_update(model, index, group);
+			index++;
+			n++;
+		}
+	}
+
+	g_array_free(groups, TRUE);
+	g_hash_table_destroy(old_xids);
+	g_hash_table_destroy(new_xids);
+}
+
+const XRRModeInfo *mode_model_get_mode(ModeModel *model, GtkTreeIter *iter)
+{
+	struct mode_row *row = row_get(model, iter_index(iter));
+
+	if (iter_alias(iter) < 0)
+		return row->mode_info;
+
+	return g_ptr_array_index(row->aliases, iter_alias(iter));
+}
@@ -0,0 +1,35 @@
+/*
+ * mode-model.h
+ *
+ * GtkTreeModel listing the modes of one output, one row per timing.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef MODE_MODEL_H
+#define MODE_MODEL_H
+
+#include <gtk/gtk.h>
+#include <X11/extensions/Xrandr.h>
+
+enum {
+	XID_COLUMN,
+	PREFERRED_COLUMN,
+	MODE_COLUMN,
+	N_COLUMNS
+};
+
+#define MODE_TYPE_MODEL (mode_model_get_type())
+G_DECLARE_FINAL_TYPE(ModeModel, mode_model, MODE, MODEL, GObject)
+
+ModeModel *mode_model_new(void);
+void mode_model_update(ModeModel *model, XRRModeInfo **mode_infos,
+		       const gboolean *preferred, int nmode);
+const XRRModeInfo *mode_model_get_mode(ModeModel *model, GtkTreeIter *iter);
+
+#endif
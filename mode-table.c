@@ -0,0 +1,172 @@
+/*
+ * mode-table.c
+ *
+ * Timing metrics of all modes of a snapshot, computed in one go. The
+ * modes are kept as a struct of arrays so the kernel can stream through
+ * them two doubles at a time.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+/* bits per pixel the link data rate is given for */
+#define MODE_TABLE_BPP 24
+
+/* copy the inputs of mode_info into slot k */
+void mode_table_set(struct mode_table *t, int k, const XRRModeInfo *mode_info)
+{
+	double vscan = mode_info->vTotal;
+
+	/* doublescan doubles the number of lines */
+	if (mode_info->modeFlags & RR_DoubleScan)
+		vscan *= 2;
+	/*
+	 * interlace splits the frame into two fields, the field rate is
+	 * what is typically reported by monitors
+	 */
+	if (mode_info->modeFlags & RR_Interlace)
+		vscan /= 2;
+
+	t->dot_clock[k] = mode_info->dotClock;
+	t->htotal[k] = mode_info->hTotal;
+	t->vtotal[k] = mode_info->vTotal;
+	t->vscan[k] = vscan;
+	t->width[k] = mode_info->width;
+	t->height[k] = mode_info->height;
+	t->flags[k] = mode_info->modeFlags;
+}
+
+static void metrics_one(struct mode_table *t, int k)
+{
+	double line = t->htotal[k] * t->vscan[k];
+	double frame = t->htotal[k] * t->vtotal[k];
+
+	t->refresh[k] = line ? t->dot_clock[k] / line : 0;
+	t->hfreq[k] = t->htotal[k] ? t->dot_clock[k] / t->htotal[k] : 0;
+	t->blanking[k] = frame ? 1.0 - t->width[k] * t->height[k] / frame : 0;
+	t->bandwidth[k] = t->dot_clock[k] * MODE_TABLE_BPP;
+}
+
+/*
+ * Refresh, line rate, blanking share and data rate for all modes. Modes
+ * with a zero total get zero instead of a division by zero.
+ */
+void mode_table_compute(struct mode_table *t)
+{
+	int k = 0;
+
+#ifdef __SSE2__
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d one = _mm_set1_pd(1.0);
+	const __m128d bpp = _mm_set1_pd(MODE_TABLE_BPP);
+
+	for (; k + 2 <= t->n; k += 2) {
+		__m128d clk = _mm_loadu_pd(t->dot_clock + k);
+		__m128d htotal = _mm_loadu_pd(t->htotal + k);
+		__m128d line = _mm_mul_pd(htotal, _mm_loadu_pd(t->vscan + k));
+		__m128d frame = _mm_mul_pd(htotal,
+					   _mm_loadu_pd(t->vtotal + k));
+		__m128d area = _mm_mul_pd(_mm_loadu_pd(t->width + k),
+					  _mm_loadu_pd(t->height + k));
+		__m128d blanking;
+
+		/* lanes dividing by zero are masked off afterwards */
+		_mm_storeu_pd(t->refresh + k,
+			      _mm_and_pd(_mm_cmpneq_pd(line, zero),
+					 _mm_div_pd(clk, line)));
+		_mm_storeu_pd(t->hfreq + k,
+			      _mm_and_pd(_mm_cmpneq_pd(htotal, zero),
+					 _mm_div_pd(clk, htotal)));
+		blanking = _mm_sub_pd(one, _mm_div_pd(area, frame));
+		_mm_storeu_pd(t->blanking + k,
+			      _mm_and_pd(_mm_cmpneq_pd(frame, zero), blanking));
+		_mm_storeu_pd(t->bandwidth + k, _mm_mul_pd(clk, bpp));
+	}
+#endif
+
+	for (; k < t->n; ++k)
+		metrics_one(t, k);
+}
+
+/*
+ * Metrics of mode_info, read from the table of res if the mode belongs
+ * to it. Anything else, e.g. modes advertised by an EDID, is computed
+ * on the spot.
+ */
+void mode_metrics_get(const struct resources *res, const XRRModeInfo *mode_info,
+		      struct mode_metrics *m)
+{
+	const struct mode_table *t;
+	int k = res ? resources_mode_index(res, mode_info) : -1;
+	double in[6], out[4];
+	unsigned int flags;
+	struct mode_table one = {
+		.n = 1,
+		.dot_clock = &in[0], .htotal = &in[1], .vtotal = &in[2],
+		.vscan = &in[3], .width = &in[4], .height = &in[5],
+		.flags = &flags,
+		.refresh = &out[0], .hfreq = &out[1], .blanking = &out[2],
+		.bandwidth = &out[3],
+	};
+
+	if (k < 0) {
+		mode_table_set(&one, 0, mode_info);
+		mode_table_compute(&one);
+		t = &one;
+		k = 0;
+	} else {
+		t = &res->table;
+	}
+
+	m->refresh = t->refresh[k];
+	m->hfreq = t->hfreq[k];
+	m->blanking = t->blanking[k];
+	m->bandwidth = t->bandwidth[k];
+}
+
+/*
+ * Canonical timing of a mode, for GHashTable: everything but the id and
+ * the name, so modes that only differ in those fall together.
+ */
+guint mode_timing_hash(gconstpointer key)
+{
+	const XRRModeInfo *m = key;
+	guint h = m->dotClock / 1000;
+
+	h = h * 31 + m->width;
+	h = h * 31 + m->hSyncStart;
+	h = h * 31 + m->hSyncEnd;
+	h = h * 31 + m->hTotal;
+	h = h * 31 + m->hSkew;
+	h = h * 31 + m->height;
+	h = h * 31 + m->vSyncStart;
+	h = h * 31 + m->vSyncEnd;
+	h = h * 31 + m->vTotal;
+
+	return h * 31 + m->modeFlags;
+}
+
+gboolean mode_timing_equal(gconstpointer a, gconstpointer b)
+{
+	const XRRModeInfo *ma = a;
+	const XRRModeInfo *mb = b;
+
+	return ma->width == mb->width && ma->height == mb->height &&
+	    ma->dotClock == mb->dotClock && ma->hSyncStart == mb->hSyncStart &&
+	    ma->hSyncEnd == mb->hSyncEnd && ma->hTotal == mb->hTotal &&
+	    ma->hSkew == mb->hSkew && ma->vSyncStart == mb->vSyncStart &&
+	    ma->vSyncEnd == mb->vSyncEnd && ma->vTotal == mb->vTotal &&
+	    ma->modeFlags == mb->modeFlags;
+}
@@ -0,0 +1,1122 @@
+/*
+ * randr-xcb.c
+ *
+ * Pipelined RandR queries using XCB. All requests that do not depend on
+ * each other are sent before the first reply is read, so fetching the
+ * complete state costs two round trips regardless of the number of
+ * outputs.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
+
+#include "gresolutions.h"
+
+/* the EDID base block in 32 bit units, extensions are read on demand */
+#define EDID_BASE_LONG_LENGTH 32
+
+/*
+ * GetScreenResources and GetScreenResourcesCurrent have identical replies
+ * but distinct accessors, so both are unpacked into this view.
+ */
+struct screen_reply {
+	void *reply;
+	xcb_timestamp_t timestamp;
+	xcb_timestamp_t config_timestamp;
+	xcb_randr_crtc_t *crtcs;
+	int ncrtc;
+	xcb_randr_output_t *outputs;
+	int noutput;
+	xcb_randr_mode_info_t *modes;
+	int nmode;
+	uint8_t *names;
+};
+
+static int screen_reply_get(xcb_connection_t *c, xcb_window_t root,
+			    int probe, xcb_intern_atom_cookie_t atom_cookie,
+			    xcb_atom_t *atom, struct screen_reply *sr)
+{
+	xcb_randr_get_screen_resources_cookie_t probe_cookie;
+	xcb_randr_get_screen_resources_current_cookie_t current_cookie;
+	xcb_intern_atom_reply_t *atom_reply;
+
+	/*
+	 * GetScreenResources makes the server poll every connector, which
+	 * may take hundreds of milliseconds per output. Only do that when
+	 * explicitly asked to.
+	 */
+	if (probe)
+		probe_cookie = xcb_randr_get_screen_resources(c, root);
+	else
+		current_cookie = xcb_randr_get_screen_resources_current(c, root);
+
+	atom_reply = xcb_intern_atom_reply(c, atom_cookie, NULL);
+	if (atom_reply) {
+		*atom = atom_reply->atom;
+		free(atom_reply);
+	}
+
+	if (probe) {
+		xcb_randr_get_screen_resources_reply_t *r =
+		    xcb_randr_get_screen_resources_reply(c, probe_cookie, NULL);
+
+		if (!r)
+			return -1;
+
+		sr->reply = r;
+		sr->timestamp = r->timestamp;
+		sr->config_timestamp = r->config_timestamp;
+		sr->crtcs = xcb_randr_get_screen_resources_crtcs(r);
+		sr->ncrtc = xcb_randr_get_screen_resources_crtcs_length(r);
+		sr->outputs = xcb_randr_get_screen_resources_outputs(r);
+		sr->noutput = xcb_randr_get_screen_resources_outputs_length(r);
+		sr->modes = xcb_randr_get_screen_resources_modes(r);
+		sr->nmode = xcb_randr_get_screen_resources_modes_length(r);
+		sr->names = xcb_randr_get_screen_resources_names(r);
+	} else {
+		xcb_randr_get_screen_resources_current_reply_t *r =
+		    xcb_randr_get_screen_resources_current_reply(c,
+								 current_cookie,
+								 NULL);
+
+		if (!r)
+			return -1;
+
+		sr->reply = r;
+		sr->timestamp = r->timestamp;
+		sr->config_timestamp = r->config_timestamp;
+		sr->crtcs = xcb_randr_get_screen_resources_current_crtcs(r);
+		sr->ncrtc =
+		    xcb_randr_get_screen_resources_current_crtcs_length(r);
+		sr->outputs = xcb_randr_get_screen_resources_current_outputs(r);
+		sr->noutput =
+		    xcb_randr_get_screen_resources_current_outputs_length(r);
+		sr->modes = xcb_randr_get_screen_resources_current_modes(r);
+		sr->nmode =
+		    xcb_randr_get_screen_resources_current_modes_length(r);
+		sr->names = xcb_randr_get_screen_resources_current_names(r);
+	}
+
+	return 0;
+}
+
+/*
+ * Replies are not copied while a draft is assembled, the draft borrows
+ * from them. Only XIDs have to be widened into scratch arrays, since
+ * XCB uses 32 bit values where Xlib uses longs.
+ */
+struct draft {
+	struct resources res;
+	GPtrArray *replies;
+	GPtrArray *scratch;
+};
+
+static void draft_init(struct draft *draft)
+{
+	memset(&draft->res, 0, sizeof(draft->res));
+	draft->replies = g_ptr_array_new_with_free_func(free);
+	draft->scratch = g_ptr_array_new_with_free_func(g_free);
+}
+
+static void draft_clear(struct draft *draft)
+{
+	g_ptr_array_free(draft->replies, TRUE);
+	g_ptr_array_free(draft->scratch, TRUE);
+}
+
+static XID *xids_widen(struct draft *draft, const uint32_t *xids, int n)
+{
+	XID *wide = g_new(XID, n);
+	int k;
+
+	for (k = 0; k < n; ++k)
+		wide[k] = xids[k];
+	g_ptr_array_add(draft->scratch, wide);
+
+	return wide;
+}
+
+static void modes_borrow(struct draft *draft, struct screen_reply *sr)
+{
+	struct resources *res = &draft->res;
+	xcb_randr_mode_info_t *modes = sr->modes;
+	uint8_t *names = sr->names;
+	int k;
+
+	res->nmode = sr->nmode;
+	res->modes = g_new0(XRRModeInfo, res->nmode);
+	g_ptr_array_add(draft->scratch, res->modes);
+
+	/* mode names are stored back to back in the order of the modes */
+	for (k = 0; k < res->nmode; ++k) {
+		XRRModeInfo *mode_info = &res->modes[k];
+
+		mode_info->id = modes[k].id;
+		mode_info->width = modes[k].width;
+		mode_info->height = modes[k].height;
+		mode_info->dotClock = modes[k].dot_clock;
+		mode_info->hSyncStart = modes[k].hsync_start;
+		mode_info->hSyncEnd = modes[k].hsync_end;
+		mode_info->hTotal = modes[k].htotal;
+		mode_info->hSkew = modes[k].hskew;
+		mode_info->vSyncStart = modes[k].vsync_start;
+		mode_info->vSyncEnd = modes[k].vsync_end;
+		mode_info->vTotal = modes[k].vtotal;
+		mode_info->modeFlags = modes[k].mode_flags;
+		mode_info->nameLength = modes[k].name_len;
+		mode_info->name = (char *)names;
+		names += modes[k].name_len;
+	}
+}
+
+static void output_borrow(struct draft *draft,
+			  struct output_info *output_info, RROutput id,
+			  xcb_randr_get_output_info_reply_t *reply,
+			  xcb_randr_get_output_property_reply_t *edid_reply)
+{
+	memset(output_info, 0, sizeof(*output_info));
+	output_info->id = id;
+	output_info->name = (char *)xcb_randr_get_output_info_name(reply);
+	output_info->nameLen = xcb_randr_get_output_info_name_length(reply);
+	output_info->connection = reply->connection;
+	output_info->crtc = reply->crtc;
+	output_info->nmode = xcb_randr_get_output_info_modes_length(reply);
+	output_info->npreferred = reply->num_preferred;
+	output_info->modes = xids_widen(draft,
+					xcb_randr_get_output_info_modes(reply),
+					output_info->nmode);
+
+	if (edid_reply && (edid_reply->type == XCB_ATOM_INTEGER) &&
+	    (edid_reply->format == 8) &&
+	    (xcb_randr_get_output_property_data_length(edid_reply) > 0)) {
+		output_info->edid =
+		    xcb_randr_get_output_property_data(edid_reply);
+		output_info->edid_length =
+		    xcb_randr_get_output_property_data_length(edid_reply);
+		output_info->edid_bytes_after = edid_reply->bytes_after;
+	}
+}
+
+static void crtc_borrow(struct draft *draft, struct crtc_info *crtc_info,
+			RRCrtc id, xcb_randr_get_crtc_info_reply_t *reply)
+{
+	crtc_info->id = id;
+	crtc_info->x = reply->x;
+	crtc_info->y = reply->y;
+	crtc_info->width = reply->width;
+	crtc_info->height = reply->height;
+	crtc_info->mode = reply->mode;
+	crtc_info->rotation = reply->rotation;
+	crtc_info->noutput = xcb_randr_get_crtc_info_outputs_length(reply);
+	crtc_info->outputs = xids_widen(draft,
+					xcb_randr_get_crtc_info_outputs(reply),
+					crtc_info->noutput);
+}
+
+/* GetOutputInfo and GetCrtcInfo replies carry a status, 0 if valid */
+#define INFO_STATUS_OK 0
+
+/*
+ * Pipelined queries for a set of outputs and crtcs. The reply arrays are
+ * filled with NULL for requests that failed.
+ */
+struct batch {
+	int noutput;
+	xcb_randr_get_output_info_reply_t **outputs;
+	xcb_randr_get_output_property_reply_t **edids;
+	int ncrtc;
+	xcb_randr_get_crtc_info_reply_t **crtcs;
+};
+
+static void batch_query(xcb_connection_t *c, struct draft *draft,
+			struct batch *batch, xcb_atom_t edid,
+			const RROutput *outputs, int noutput,
+			const RRCrtc *crtcs, int ncrtc)
+{
+	xcb_randr_get_output_info_cookie_t *output_cookies;
+	xcb_randr_get_output_property_cookie_t *edid_cookies;
+	xcb_randr_get_crtc_info_cookie_t *crtc_cookies;
+	xcb_timestamp_t config_timestamp = draft->res.config_timestamp;
+	int k;
+
+	output_cookies = g_new(xcb_randr_get_output_info_cookie_t, noutput);
+	edid_cookies = g_new(xcb_randr_get_output_property_cookie_t, noutput);
+	crtc_cookies = g_new(xcb_randr_get_crtc_info_cookie_t, ncrtc);
+
+	for (k = 0; k < noutput; ++k) {
+		output_cookies[k] =
+		    xcb_randr_get_output_info(c, outputs[k], config_timestamp);
+		if (edid != XCB_ATOM_NONE)
+			edid_cookies[k] =
+			    xcb_randr_get_output_property(c, outputs[k], edid,
+							  XCB_ATOM_ANY, 0,
+							  EDID_BASE_LONG_LENGTH,
+							  0, 0);
+	}
+
+	for (k = 0; k < ncrtc; ++k)
+		crtc_cookies[k] = xcb_randr_get_crtc_info(c, crtcs[k],
+							  config_timestamp);
+
+	xcb_flush(c);
+
+	batch->noutput = noutput;
+	batch->outputs = g_new0(xcb_randr_get_output_info_reply_t *, noutput);
+	batch->edids = g_new0(xcb_randr_get_output_property_reply_t *,
+			      noutput);
+	batch->ncrtc = ncrtc;
+	batch->crtcs = g_new0(xcb_randr_get_crtc_info_reply_t *, ncrtc);
+	g_ptr_array_add(draft->scratch, batch->outputs);
+	g_ptr_array_add(draft->scratch, batch->edids);
+	g_ptr_array_add(draft->scratch, batch->crtcs);
+
+	for (k = 0; k < noutput; ++k) {
+		batch->outputs[k] =
+		    xcb_randr_get_output_info_reply(c, output_cookies[k],
+						    NULL);
+		if (batch->outputs[k] &&
+		    batch->outputs[k]->status != INFO_STATUS_OK) {
+			free(batch->outputs[k]);
+			batch->outputs[k] = NULL;
+		}
+		if (batch->outputs[k])
+			g_ptr_array_add(draft->replies, batch->outputs[k]);
+
+		if (edid != XCB_ATOM_NONE)
+			batch->edids[k] =
+			    xcb_randr_get_output_property_reply(c,
+								edid_cookies
+								[k], NULL);
+		if (batch->edids[k])
+			g_ptr_array_add(draft->replies, batch->edids[k]);
+	}
+
+	for (k = 0; k < ncrtc; ++k) {
+		batch->crtcs[k] =
+		    xcb_randr_get_crtc_info_reply(c, crtc_cookies[k], NULL);
+		if (batch->crtcs[k] &&
+		    batch->crtcs[k]->status != INFO_STATUS_OK) {
+			free(batch->crtcs[k]);
+			batch->crtcs[k] = NULL;
+		}
+		if (batch->crtcs[k])
+			g_ptr_array_add(draft->replies, batch->crtcs[k]);
+	}
+
+	g_free(output_cookies);
+	g_free(edid_cookies);
+	g_free(crtc_cookies);
+}
+
+struct resources *resources_get(xcb_connection_t *c, xcb_window_t root,
+				int probe)
+{
+	xcb_intern_atom_cookie_t atom_cookie;
+	xcb_atom_t edid = XCB_ATOM_NONE;
+	struct screen_reply sr;
+	struct resources *res;
+	struct draft draft;
+	struct batch batch;
+	RROutput *outputs;
+	RRCrtc *crtcs;
+	int k;
+
+	/* first round trip: screen resources and the EDID atom */
+	atom_cookie = xcb_intern_atom(c, 0, strlen(RR_PROPERTY_RANDR_EDID),
+				      RR_PROPERTY_RANDR_EDID);
+	if (screen_reply_get(c, root, probe, atom_cookie, &edid, &sr))
+		return NULL;
+
+	draft_init(&draft);
+	g_ptr_array_add(draft.replies, sr.reply);
+	draft.res.edid_atom = edid;
+	draft.res.timestamp = sr.timestamp;
+	draft.res.config_timestamp = sr.config_timestamp;
+	modes_borrow(&draft, &sr);
+
+	outputs = xids_widen(&draft, sr.outputs, sr.noutput);
+	crtcs = xids_widen(&draft, sr.crtcs, sr.ncrtc);
+
+	/* second round trip: everything about every output and crtc */
+	batch_query(c, &draft, &batch, edid, outputs, sr.noutput, crtcs,
+		    sr.ncrtc);
+
+	draft.res.outputs = g_new0(struct output_info, batch.noutput);
+	g_ptr_array_add(draft.scratch, draft.res.outputs);
+	for (k = 0; k < batch.noutput; ++k) {
+		if (!batch.outputs[k])
+			continue;
+
+		output_borrow(&draft,
+			      &draft.res.outputs[draft.res.noutput++],
+			      outputs[k], batch.outputs[k], batch.edids[k]);
+	}
+
+	draft.res.crtcs = g_new0(struct crtc_info, batch.ncrtc);
+	g_ptr_array_add(draft.scratch, draft.res.crtcs);
+	for (k = 0; k < batch.ncrtc; ++k) {
+		if (!batch.crtcs[k])
+			continue;
+
+		crtc_borrow(&draft, &draft.res.crtcs[draft.res.ncrtc++],
+			    crtcs[k], batch.crtcs[k]);
+	}
+
+	res = resources_freeze(&draft.res);
+	draft_clear(&draft);
+
+	return res;
+}
+
+/*
+ * Re-query only the given outputs and crtcs and return a new snapshot
+ * with them replaced. modes are new ones the caller created itself and
+ * knows the timings of, they are added to the snapshot. Returns NULL if
+ * the server configuration moved on or new outputs, crtcs or other modes
+ * showed up, in which case the caller has to fetch the complete
+ * resources instead.
+ */
+static const XRRModeInfo *modes_find(const XRRModeInfo *modes, int nmode,
+				     RRMode mode)
+{
+	int k;
+
+	for (k = 0; k < nmode; ++k) {
+		if (modes[k].id == mode)
+			return &modes[k];
+	}
+
+	return NULL;
+}
+
+struct resources *resources_update(xcb_connection_t *c, xcb_window_t root,
+				   const struct resources *res,
+				   const RROutput *outputs, int noutput,
+				   const RRCrtc *crtcs, int ncrtc,
+				   const XRRModeInfo *modes, int nmode)
+{
+	xcb_randr_get_screen_resources_current_cookie_t current_cookie;
+	xcb_randr_get_screen_resources_current_reply_t *current;
+	struct resources *new_res = NULL;
+	struct draft draft;
+	struct batch batch;
+	int k, n;
+
+	/* goes out with the batch, to tell whether res is still the base */
+	current_cookie = xcb_randr_get_screen_resources_current(c, root);
+
+	draft_init(&draft);
+	draft.res = *res;
+	draft.res.outputs = g_new(struct output_info, res->noutput);
+	memcpy(draft.res.outputs, res->outputs,
+	       res->noutput * sizeof(struct output_info));
+	draft.res.crtcs = g_new(struct crtc_info, res->ncrtc);
+	memcpy(draft.res.crtcs, res->crtcs,
+	       res->ncrtc * sizeof(struct crtc_info));
+	g_ptr_array_add(draft.scratch, draft.res.outputs);
+	g_ptr_array_add(draft.scratch, draft.res.crtcs);
+	if (nmode) {
+		draft.res.modes = g_new(XRRModeInfo, res->nmode + nmode);
+		memcpy(draft.res.modes, res->modes,
+		       res->nmode * sizeof(XRRModeInfo));
+		for (k = 0; k < nmode; ++k) {
+			if (modes[k].id && !resources_find_mode(res, modes[k].id))
+				draft.res.modes[draft.res.nmode++] = modes[k];
+		}
+		g_ptr_array_add(draft.scratch, draft.res.modes);
+	}
+
+	batch_query(c, &draft, &batch, res->edid_atom, outputs, noutput,
+		    crtcs, ncrtc);
+
+	current = xcb_randr_get_screen_resources_current_reply(c,
+							       current_cookie,
+							       NULL);
+	if (!current)
+		goto out;
+	g_ptr_array_add(draft.replies, current);
+	if (current->config_timestamp != res->config_timestamp)
+		goto out;
+
+	for (k = 0; k < noutput; ++k) {
+		struct output_info *output_info =
+		    resources_find_output(&draft.res, outputs[k]);
+
+		if (!batch.outputs[k] || !output_info)
+			goto out;
+
+		output_borrow(&draft, output_info, outputs[k],
+			      batch.outputs[k], batch.edids[k]);
+
+		for (n = 0; n < output_info->nmode; ++n) {
+			if (!resources_find_mode(res, output_info->modes[n]) &&
+			    !modes_find(modes, nmode, output_info->modes[n]))
+				goto out;
+		}
+	}
+
+	for (k = 0; k < ncrtc; ++k) {
+		struct crtc_info *crtc_info =
+		    resources_find_crtc(&draft.res, crtcs[k]);
+
+		if (!batch.crtcs[k] || !crtc_info)
+			goto out;
+
+		crtc_borrow(&draft, crtc_info, crtcs[k], batch.crtcs[k]);
+	}
+
+	new_res = resources_freeze(&draft.res);
+
+ out:
+	draft_clear(&draft);
+
+	return new_res;
+}
+
+xcb_window_t screen_root(xcb_connection_t *c, int screen)
+{
+	xcb_screen_iterator_t it =
+	    xcb_setup_roots_iterator(xcb_get_setup(c));
+
+	for (; it.rem; --screen, xcb_screen_next(&it)) {
+		if (!screen)
+			return it.data->root;
+	}
+
+	return XCB_WINDOW_NONE;
+}
+
+/* drive crtc with mode on output alone, returns 0 on success */
+int crtc_set_mode(xcb_connection_t *c, Time config_timestamp, RRCrtc crtc,
+		  RROutput output, RRMode mode)
+{
+	return crtcs_set_modes(c, config_timestamp, &crtc, &output, &mode, 1);
+}
+
+/*
+ * Drive crtcs[k] with modes[k] on outputs[k] alone, all requests sent
+ * before the first reply is read. Returns 0 if all succeeded, otherwise
+ * the status of the first that failed.
+ */
+int crtcs_set_modes(xcb_connection_t *c, Time config_timestamp,
+		    const RRCrtc *crtcs, const RROutput *outputs,
+		    const RRMode *modes, int n)
+{
+	xcb_randr_set_crtc_config_cookie_t *cookies;
+	int k, status = 0;
+
+	cookies = g_new(xcb_randr_set_crtc_config_cookie_t, n);
+	for (k = 0; k < n; ++k) {
+		xcb_randr_output_t id = outputs[k];
+
+		cookies[k] = xcb_randr_set_crtc_config(c, crtcs[k],
+						       XCB_CURRENT_TIME,
+						       config_timestamp, 0, 0,
+						       modes[k],
+						       XCB_RANDR_ROTATION_ROTATE_0,
+						       1, &id);
+	}
+	xcb_flush(c);
+
+	for (k = 0; k < n; ++k) {
+		xcb_randr_set_crtc_config_reply_t *reply =
+		    xcb_randr_set_crtc_config_reply(c, cookies[k], NULL);
+
+		if (!status)
+			status = reply ? reply->status : -1;
+		free(reply);
+	}
+	g_free(cookies);
+
+	return status;
+}
+
+static int crtc_configure(xcb_connection_t *c, Time config_timestamp,
+			  const struct crtc_change *change)
+{
+	xcb_randr_set_crtc_config_cookie_t cookie;
+	xcb_randr_set_crtc_config_reply_t *reply;
+	xcb_randr_output_t *ids = g_new(xcb_randr_output_t, change->noutput);
+	int k, status;
+
+	for (k = 0; k < change->noutput; ++k)
+		ids[k] = change->outputs[k];
+
+	cookie = xcb_randr_set_crtc_config(c, change->crtc, XCB_CURRENT_TIME,
+					   config_timestamp, change->x,
+					   change->y, change->mode,
+					   change->rotation, change->noutput,
+					   ids);
+	g_free(ids);
+	reply = xcb_randr_set_crtc_config_reply(c, cookie, NULL);
+	if (!reply)
+		return -1;
+
+	status = reply->status;
+	free(reply);
+
+	return status;
+}
+
+static int crtc_disable(xcb_connection_t *c, Time config_timestamp,
+			RRCrtc crtc)
+{
+	struct crtc_change off = { crtc, None, 0, 0, RR_Rotate_0, 0, NULL };
+
+	return crtc_configure(c, config_timestamp, &off);
+}
+
+/* what crtc_info shows now, as a change that restores it */
+static void crtc_change_current(const struct crtc_info *crtc_info,
+				struct crtc_change *change)
+{
+	change->crtc = crtc_info->id;
+	change->mode = crtc_info->mode;
+	change->x = crtc_info->x;
+	change->y = crtc_info->y;
+	change->rotation = crtc_info->rotation;
+	change->noutput = crtc_info->noutput;
+	change->outputs = crtc_info->outputs;
+}
+
+/* lower right corner of change on the screen, -1 for an unknown mode */
+static int crtc_change_extent(const struct resources *res,
+			      const struct crtc_change *change,
+			      unsigned int *right, unsigned int *bottom)
+{
+	XRRModeInfo *mode_info;
+	unsigned int width, height;
+
+	if (!change->mode)
+		return 0;
+
+	mode_info = resources_find_mode(res, change->mode);
+	if (!mode_info)
+		return -1;
+
+	width = mode_info->width;
+	height = mode_info->height;
+	if (change->rotation & (RR_Rotate_90 | RR_Rotate_270)) {
+		width = mode_info->height;
+		height = mode_info->width;
+	}
+	*right = MAX(*right, change->x + width);
+	*bottom = MAX(*bottom, change->y + height);
+
+	return 0;
+}
+
+static int screen_set_size(xcb_connection_t *c, xcb_window_t root,
+			   unsigned int width, unsigned int height)
+{
+	xcb_void_cookie_t cookie;
+	xcb_generic_error_t *error;
+
+	/* the physical size is made up, at 96 dpi */
+	cookie = xcb_randr_set_screen_size_checked(c, root, width, height,
+						   width * 254 / 960,
+						   height * 254 / 960);
+	error = xcb_request_check(c, cookie);
+	if (!error)
+		return 0;
+	free(error);
+
+	return -1;
+}
+
+/*
+ * Switch every CRTC in changes to its new configuration in one go: the
+ * screen is grabbed, the CRTCs that change are turned off, the screen
+ * is resized once to hold the new layout and the CRTCs are set up
+ * again. If a step fails, the CRTCs and the screen size of res are put
+ * back before the grab is released. CRTCs not in changes keep what res
+ * says they show. Returns 0 on success, -1 if a CRTC is in changes
+ * twice or the layout does not fit the screen limits, otherwise the
+ * status of the step that failed.
+ */
+int crtcs_configure(xcb_connection_t *c, xcb_window_t root,
+		    const struct resources *res,
+		    const struct crtc_change *changes, int n)
+{
+	xcb_get_geometry_reply_t *geometry;
+	xcb_randr_get_screen_size_range_reply_t *range;
+	unsigned int width = 0, height = 0, old_width, old_height;
+	struct crtc_change restore;
+	int k, done = 0, status = 0;
+
+	/* the new layout: changed CRTCs plus those that stay as they are */
+	for (k = 0; k < res->ncrtc; ++k) {
+		int j;
+
+		for (j = 0; j < n; ++j) {
+			if (changes[j].crtc == res->crtcs[k].id)
+				break;
+		}
+		if (j < n)
+			continue;
+
+		crtc_change_current(&res->crtcs[k], &restore);
+		if (crtc_change_extent(res, &restore, &width, &height))
+			return -1;
+	}
+	for (k = 0; k < n; ++k) {
+		int j;
+
+		if (!resources_find_crtc(res, changes[k].crtc) ||
+		    crtc_change_extent(res, &changes[k], &width, &height))
+			return -1;
+
+		/* one change per CRTC, otherwise they would fight */
+		for (j = 0; j < k; ++j) {
+			if (changes[j].crtc == changes[k].crtc)
+				return -1;
+		}
+	}
+
+	geometry = xcb_get_geometry_reply(c, xcb_get_geometry(c, root), NULL);
+	range = xcb_randr_get_screen_size_range_reply(c,
+			xcb_randr_get_screen_size_range(c, root), NULL);
+	if (!geometry || !range) {
+		free(geometry);
+		free(range);
+		return -1;
+	}
+	old_width = geometry->width;
+	old_height = geometry->height;
+	width = MAX(width, range->min_width);
+	height = MAX(height, range->min_height);
+	if (width > range->max_width || height > range->max_height)
+		status = -1;
+	free(geometry);
+	free(range);
+	if (status)
+		return status;
+
+	xcb_grab_server(c);
+
+	for (k = 0; k < n && !status; ++k) {
+		if (resources_find_crtc(res, changes[k].crtc)->mode)
+			status = crtc_disable(c, res->config_timestamp,
+					      changes[k].crtc);
+	}
+
+	if (!status && (width != old_width || height != old_height))
+		status = screen_set_size(c, root, width, height);
+
+	for (; done < n && !status; ++done) {
+		if (changes[done].mode)
+			status = crtc_configure(c, res->config_timestamp,
+						&changes[done]);
+	}
+
+	if (status) {
+		g_warning("CRTC configuration failed (%d), rolling back\n",
+			  status);
+		for (k = 0; k < done; ++k)
+			crtc_disable(c, res->config_timestamp, changes[k].crtc);
+		screen_set_size(c, root, old_width, old_height);
+		for (k = 0; k < n; ++k) {
+			crtc_change_current(resources_find_crtc
+					    (res, changes[k].crtc), &restore);
+			if (restore.mode)
+				crtc_configure(c, res->config_timestamp,
+					       &restore);
+		}
+	}
+
+	xcb_ungrab_server(c);
+	xcb_flush(c);
+
+	return status;
+}
+
+static XRRModeInfo *mode_find_name(const struct resources *res,
+				   const char *name)
+{
+	int k;
+
+	for (k = 0; k < res->nmode; ++k) {
+		if (!strcmp(res->modes[k].name, name))
+			return &res->modes[k];
+	}
+
+	return NULL;
+}
+
+static int mode_listed_by(const struct output_info *output_info, RRMode mode)
+{
+	int k;
+
+	for (k = 0; output_info && k < output_info->nmode; ++k) {
+		if (output_info->modes[k] == mode)
+			return 1;
+	}
+
+	return 0;
+}
+
+static xcb_randr_mode_info_t mode_info_wire(const XRRModeInfo *mode_info)
+{
+	xcb_randr_mode_info_t wire = {
+		.width = mode_info->width,
+		.height = mode_info->height,
+		.dot_clock = mode_info->dotClock,
+		.hsync_start = mode_info->hSyncStart,
+		.hsync_end = mode_info->hSyncEnd,
+		.htotal = mode_info->hTotal,
+		.hskew = mode_info->hSkew,
+		.vsync_start = mode_info->vSyncStart,
+		.vsync_end = mode_info->vSyncEnd,
+		.vtotal = mode_info->vTotal,
+		.name_len = mode_info->nameLength,
+		.mode_flags = mode_info->modeFlags,
+	};
+
+	return wire;
+}
+
+/*
+ * Add modes to output as one batch: all of them are created, then all
+ * of them are added, with one round trip per step. A mode the server
+ * already has under the same name is reused if the timings agree, a
+ * different timing under that name is refused. The new ids go to
+ * modes[k].id, 0 for modes that could not be added. Returns the number
+ * of modes added, -1 if output is not in res.
+ */
+int output_modes_add(xcb_connection_t *c, xcb_window_t root,
+		     const struct resources *res, RROutput output,
+		     XRRModeInfo *modes, int nmode)
+{
+	struct output_info *output_info = resources_find_output(res, output);
+	xcb_randr_create_mode_cookie_t *create_cookies;
+	xcb_void_cookie_t *add_cookies;
+	gboolean *created, *listed;
+	int k, added = 0;
+
+	if (!output_info)
+		return -1;
+
+	create_cookies = g_new0(xcb_randr_create_mode_cookie_t, nmode);
+	add_cookies = g_new0(xcb_void_cookie_t, nmode);
+	created = g_new0(gboolean, nmode);
+	listed = g_new0(gboolean, nmode);
+
+	for (k = 0; k < nmode; ++k) {
+		XRRModeInfo *known = mode_find_name(res, modes[k].name);
+
+		modes[k].id = 0;
+		if (known) {
+			if (mode_timing_equal(known, &modes[k]))
+				modes[k].id = known->id;
+			else
+				g_warning("mode %s exists with other timings\n",
+					  modes[k].name);
+			continue;
+		}
+
+		create_cookies[k] =
+		    xcb_randr_create_mode(c, root, mode_info_wire(&modes[k]),
+					  modes[k].nameLength, modes[k].name);
+		created[k] = TRUE;
+	}
+	xcb_flush(c);
+
+	for (k = 0; k < nmode; ++k) {
+		xcb_randr_create_mode_reply_t *reply;
+
+		if (!created[k])
+			continue;
+
+		reply = xcb_randr_create_mode_reply(c, create_cookies[k],
+						    NULL);
+		if (reply)
+			modes[k].id = reply->mode;
+		free(reply);
+	}
+
+	for (k = 0; k < nmode; ++k) {
+		if (!modes[k].id)
+			continue;
+		if (mode_listed_by(output_info, modes[k].id)) {
+			listed[k] = TRUE;
+			continue;
+		}
+		add_cookies[k] = xcb_randr_add_output_mode_checked(c, output,
+								   modes[k].id);
+	}
+	xcb_flush(c);
+
+	for (k = 0; k < nmode; ++k) {
+		xcb_generic_error_t *error;
+
+		if (!modes[k].id)
+			continue;
+		if (listed[k]) {
+			added++;
+			continue;
+		}
+
+		error = xcb_request_check(c, add_cookies[k]);
+		if (error) {
+			modes[k].id = 0;
+			free(error);
+			continue;
+		}
+		added++;
+	}
+
+	g_free(create_cookies);
+	g_free(add_cookies);
+	g_free(created);
+	g_free(listed);
+
+	return added;
+}
+
+static int mode_in_use(const struct resources *res, RRMode mode)
+{
+	int k;
+
+	for (k = 0; k < res->ncrtc; ++k) {
+		if (res->crtcs[k].mode == mode)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int mode_listed(const struct resources *res, RRMode mode,
+		       RROutput except)
+{
+	int k;
+
+	for (k = 0; k < res->noutput; ++k) {
+		if (res->outputs[k].id != except &&
+		    mode_listed_by(&res->outputs[k], mode))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int mode_kept(const XRRModeInfo *mode_info, const XRRModeInfo *keep,
+		     int nkeep)
+{
+	int k;
+
+	for (k = 0; k < nkeep; ++k) {
+		if (!strcmp(mode_info->name, keep[k].name))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* generated, not shown by any CRTC and not named in keep */
+static int mode_prunable(const struct resources *res,
+			 const XRRModeInfo *mode_info,
+			 const XRRModeInfo *keep, int nkeep)
+{
+	return timing_generated(mode_info) &&
+	    !mode_in_use(res, mode_info->id) &&
+	    !mode_kept(mode_info, keep, nkeep);
+}
+
+/*
+ * Remove the generated modes no CRTC shows from output and destroy all
+ * generated modes no other output lists any more, in one batch. Modes
+ * named like one in keep stay, they are about to be added again.
+ * Returns the number of modes destroyed.
+ */
+int output_modes_prune(xcb_connection_t *c, const struct resources *res,
+		       RROutput output, const XRRModeInfo *keep, int nkeep)
+{
+	struct output_info *output_info = resources_find_output(res, output);
+	GArray *cookies = g_array_new(FALSE, FALSE, sizeof(xcb_void_cookie_t));
+	int k, ndelete, destroyed = 0;
+
+	for (k = 0; output_info && k < output_info->nmode; ++k) {
+		XRRModeInfo *mode_info =
+		    resources_find_mode(res, output_info->modes[k]);
+		xcb_void_cookie_t cookie;
+
+		if (!mode_info || !mode_prunable(res, mode_info, keep, nkeep))
+			continue;
+
+		cookie = xcb_randr_delete_output_mode_checked(c, output,
+							      mode_info->id);
+		g_array_append_val(cookies, cookie);
+	}
+
+	/* requests are processed in order, the deletes come first */
+	ndelete = cookies->len;
+	for (k = 0; k < res->nmode; ++k) {
+		XRRModeInfo *mode_info = &res->modes[k];
+		xcb_void_cookie_t cookie;
+
+		if (!mode_prunable(res, mode_info, keep, nkeep) ||
+		    mode_listed(res, mode_info->id, output))
+			continue;
+
+		cookie = xcb_randr_destroy_mode_checked(c, mode_info->id);
+		g_array_append_val(cookies, cookie);
+		destroyed++;
+	}
+	xcb_flush(c);
+
+	for (k = 0; k < cookies->len; ++k) {
+		xcb_generic_error_t *error =
+		    xcb_request_check(c, g_array_index(cookies,
+						       xcb_void_cookie_t, k));
+
+		/* a mode another client still holds stays around */
+		if (error && k >= ndelete)
+			destroyed--;
+		free(error);
+	}
+	g_array_free(cookies, TRUE);
+
+	return destroyed;
+}
+
+/*
+ * Full EDIDs including all extension blocks, by output. Snapshots only
+ * carry the base block; an entry stays valid as long as the base block
+ * it was fetched for is the one in the snapshot.
+ */
+static GHashTable *edid_cache;	/* RROutput -> GBytes */
+
+static GBytes *edid_fetch(xcb_connection_t *c, xcb_atom_t atom,
+			  const struct output_info *output_info)
+{
+	unsigned long length = output_info->edid_length;
+	unsigned long bytes_after = output_info->edid_bytes_after;
+	GByteArray *edid;
+
+	edid = g_byte_array_sized_new(length + bytes_after);
+	g_byte_array_append(edid, output_info->edid, length);
+
+	/* blocks are 128 bytes, so the offset is always on a 32 bit unit */
+	while (bytes_after && !(edid->len % 4)) {
+		xcb_randr_get_output_property_cookie_t cookie;
+		xcb_randr_get_output_property_reply_t *reply;
+		int n;
+
+		cookie = xcb_randr_get_output_property(c, output_info->id, atom,
+						       XCB_ATOM_ANY,
+						       edid->len / 4,
+						       (bytes_after + 3) / 4,
+						       0, 0);
+		reply = xcb_randr_get_output_property_reply(c, cookie, NULL);
+		if (!reply)
+			break;
+
+		n = xcb_randr_get_output_property_data_length(reply);
+		if (reply->type != XCB_ATOM_INTEGER || reply->format != 8 ||
+		    n <= 0) {
+			free(reply);
+			break;
+		}
+
+		g_byte_array_append(edid,
+				    xcb_randr_get_output_property_data(reply),
+				    n);
+		bytes_after = reply->bytes_after;
+		free(reply);
+	}
+
+	return g_byte_array_free_to_bytes(edid);
+}
+
+/* the cached complete EDID of output_info if it still has that base block */
+static GBytes *edid_cached(const struct output_info *output_info)
+{
+	GBytes *edid;
+	gsize size;
+	const unsigned char *data;
+
+	if (!edid_cache)
+		return NULL;
+
+	edid = g_hash_table_lookup(edid_cache,
+				   GUINT_TO_POINTER(output_info->id));
+	if (!edid)
+		return NULL;
+
+	data = g_bytes_get_data(edid, &size);
+	if (size < output_info->edid_length ||
+	    memcmp(data, output_info->edid, output_info->edid_length))
+		return NULL;
+
+	return edid;
+}
+
+/*
+ * What is known of the EDID of output_info without asking the server:
+ * the complete EDID if it was fetched already or has no extensions,
+ * the base block otherwise. *complete tells which. Returns a new
+ * reference or NULL if the output has no EDID. Main thread only.
+ */
+GBytes *output_edid_peek(const struct output_info *output_info,
+			 gboolean *complete)
+{
+	GBytes *edid;
+
+	*complete = TRUE;
+	if (!output_info->edid_length)
+		return NULL;
+
+	edid = edid_cached(output_info);
+	if (edid)
+		return g_bytes_ref(edid);
+
+	*complete = !output_info->edid_bytes_after;
+
+	return g_bytes_new(output_info->edid, output_info->edid_length);
+}
+
+/*
+ * The complete EDID of output_info, fetched the first time it is asked
+ * for and cached afterwards. The extension blocks take round trips, so
+ * only ask once they are needed, output_edid_peek() does not block.
+ * Returns a new reference or NULL if the output has no EDID. Main
+ * thread only.
+ */
+GBytes *output_edid_get(xcb_connection_t *c, const struct resources *res,
+			const struct output_info *output_info)
+{
+	GBytes *edid;
+
+	if (!output_info->edid_length)
+		return NULL;
+
+	edid = edid_cached(output_info);
+	if (edid)
+		return g_bytes_ref(edid);
+
+	if (!edid_cache)
+		edid_cache = g_hash_table_new_full(g_direct_hash,
+						   g_direct_equal, NULL,
+						   (GDestroyNotify)
+						   g_bytes_unref);
+
+	if (output_info->edid_bytes_after)
+		edid = edid_fetch(c, res->edid_atom, output_info);
+	else
+		edid = g_bytes_new(output_info->edid, output_info->edid_length);
+	g_hash_table_insert(edid_cache, GUINT_TO_POINTER(output_info->id),
+			    edid);
+
+	return g_bytes_ref(edid);
+}
@@ -0,0 +1,480 @@
+/*
+ * resources.c
+ *
+ * Immutable snapshots of the RandR state. A snapshot lives in a single
+ * allocation: the resources header, all arrays, interned mode names,
+ * EDIDs and the mode index are laid out back to back and go away with
+ * one g_free().
+ *
+ * The current snapshot is published RCU style, see resources_publish().
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+#define ARENA_SIZE(size) (((size) + 7) & ~(size_t)7)
+
+struct arena {
+	char *next;
+	char *end;
+};
+
+static void *arena_alloc(struct arena *arena, size_t size)
+{
+	void *p = arena->next;
+
+	arena->next += ARENA_SIZE(size);
+	g_assert(arena->next <= arena->end);
+
+	return p;
+}
+
+static void *arena_dup(struct arena *arena, const void *src, size_t size)
+{
+	void *p = arena_alloc(arena, size);
+
+	if (size)
+		memcpy(p, src, size);
+
+	return p;
+}
+
+static char *arena_strndup(struct arena *arena, const char *s, size_t len)
+{
+	char *p = arena_alloc(arena, len + 1);
+
+	memcpy(p, s, len);
+	p[len] = 0;
+
+	return p;
+}
+
+static unsigned int mode_slot(RRMode id)
+{
+	return (unsigned int)id * 2654435761u;
+}
+
+/* power of two with at least one free slot left */
+static unsigned int mode_nslot(int nmode)
+{
+	unsigned int nslot = 1;
+
+	while (nslot <= 2 * nmode)
+		nslot <<= 1;
+
+	return nslot;
+}
+
+/* upper bound, interning mode names only ever saves space */
+static size_t resources_size(const struct resources *draft)
+{
+	size_t size = ARENA_SIZE(sizeof(*draft));
+	int k;
+
+	size += ARENA_SIZE(draft->nmode * sizeof(XRRModeInfo));
+	size += ARENA_SIZE(mode_nslot(draft->nmode) * sizeof(unsigned int));
+	size += 10 * ARENA_SIZE(draft->nmode * sizeof(double));
+	size += ARENA_SIZE(draft->nmode * sizeof(unsigned int));
+	size += ARENA_SIZE(draft->nmode * sizeof(int));
+	for (k = 0; k < draft->nmode; ++k)
+		size += ARENA_SIZE(draft->modes[k].nameLength + 1);
+
+	size += ARENA_SIZE(draft->noutput * sizeof(struct output_info));
+	for (k = 0; k < draft->noutput; ++k) {
+		const struct output_info *output_info = &draft->outputs[k];
+
+		size += ARENA_SIZE(output_info->nameLen + 1);
+		size += ARENA_SIZE(output_info->nmode * sizeof(RRMode));
+		size += ARENA_SIZE(output_info->edid_length);
+		size += ARENA_SIZE(MODE_BITS_WORDS(draft->nmode) *
+				   sizeof(gulong));
+	}
+
+	size += ARENA_SIZE(draft->ncrtc * sizeof(struct crtc_info));
+	for (k = 0; k < draft->ncrtc; ++k)
+		size += ARENA_SIZE(draft->crtcs[k].noutput * sizeof(RROutput));
+
+	return size;
+}
+
+static void modes_freeze(struct arena *arena, struct resources *res,
+			 const struct resources *draft)
+{
+	GHashTable *names = g_hash_table_new(g_str_hash, g_str_equal);
+	unsigned int nslot = mode_nslot(draft->nmode);
+	int k;
+
+	res->modes = arena_dup(arena, draft->modes,
+			       draft->nmode * sizeof(XRRModeInfo));
+	res->mode_slots = arena_alloc(arena, nslot * sizeof(unsigned int));
+	memset(res->mode_slots, 0, nslot * sizeof(unsigned int));
+	res->mode_mask = nslot - 1;
+
+	for (k = 0; k < res->nmode; ++k) {
+		XRRModeInfo *mode_info = &res->modes[k];
+		char *name = arena_strndup(arena, mode_info->name,
+					   mode_info->nameLength);
+		char *interned = g_hash_table_lookup(names, name);
+		unsigned int slot;
+
+		/* the name is the latest allocation, so it can be dropped */
+		if (interned) {
+			arena->next = name;
+			name = interned;
+		} else {
+			g_hash_table_insert(names, name, name);
+		}
+		mode_info->name = name;
+
+		/* slots hold the mode index plus one, zero is empty */
+		for (slot = mode_slot(mode_info->id) & res->mode_mask;
+		     res->mode_slots[slot];
+		     slot = (slot + 1) & res->mode_mask) ;
+		res->mode_slots[slot] = k + 1;
+	}
+
+	g_hash_table_destroy(names);
+}
+
+static double *arena_doubles(struct arena *arena, int n)
+{
+	return arena_alloc(arena, n * sizeof(double));
+}
+
+static void table_freeze(struct arena *arena, struct resources *res)
+{
+	struct mode_table *t = &res->table;
+	GHashTable *timings;
+	int k;
+
+	t->n = res->nmode;
+	t->dot_clock = arena_doubles(arena, t->n);
+	t->htotal = arena_doubles(arena, t->n);
+	t->vtotal = arena_doubles(arena, t->n);
+	t->vscan = arena_doubles(arena, t->n);
+	t->width = arena_doubles(arena, t->n);
+	t->height = arena_doubles(arena, t->n);
+	t->flags = arena_alloc(arena, t->n * sizeof(unsigned int));
+	t->refresh = arena_doubles(arena, t->n);
+	t->hfreq = arena_doubles(arena, t->n);
+	t->blanking = arena_doubles(arena, t->n);
+	t->bandwidth = arena_doubles(arena, t->n);
+
+	t->timing = arena_alloc(arena, t->n * sizeof(int));
+
+	/* XRRModeInfo -> index of the first mode with its timing */
+	timings = g_hash_table_new(mode_timing_hash, mode_timing_equal);
+	for (k = 0; k < t->n; ++k) {
+		XRRModeInfo *mode_info = &res->modes[k];
+		gpointer first;
+
+		mode_table_set(t, k, mode_info);
+
+		if (g_hash_table_lookup_extended(timings, mode_info, NULL,
+						 &first)) {
+			t->timing[k] = GPOINTER_TO_INT(first);
+		} else {
+			t->timing[k] = k;
+			g_hash_table_insert(timings, mode_info,
+					    GINT_TO_POINTER(k));
+		}
+	}
+	g_hash_table_destroy(timings);
+
+	mode_table_compute(t);
+}
+
+/* set the bit of the timing of every mode the output lists */
+static void output_bits_freeze(struct arena *arena, struct resources *res,
+			       struct output_info *output_info)
+{
+	size_t size = MODE_BITS_WORDS(res->nmode) * sizeof(gulong);
+	int k;
+
+	output_info->mode_bits = arena_alloc(arena, size);
+	memset(output_info->mode_bits, 0, size);
+
+	for (k = 0; k < output_info->nmode; ++k) {
+		XRRModeInfo *mode_info =
+		    resources_find_mode(res, output_info->modes[k]);
+		int timing;
+
+		if (!mode_info)
+			continue;
+
+		timing = res->table.timing[resources_mode_index(res,
+								mode_info)];
+		output_info->mode_bits[timing / MODE_BITS_PER_WORD] |=
+		    1UL << timing % MODE_BITS_PER_WORD;
+	}
+}
+
+/*
+ * Copy a draft into a new snapshot. The draft may point anywhere, e.g.
+ * into XCB replies or another snapshot; none of it is referenced by the
+ * result, so it can be released right afterwards.
+ */
+struct resources *resources_freeze(const struct resources *draft)
+{
+	size_t size = resources_size(draft);
+	struct resources *res;
+	struct arena arena;
+	int k;
+
+	arena.next = g_malloc(size);
+	arena.end = arena.next + size;
+
+	res = arena_dup(&arena, draft, sizeof(*draft));
+	modes_freeze(&arena, res, draft);
+	table_freeze(&arena, res);
+
+	res->outputs = arena_dup(&arena, draft->outputs,
+				 draft->noutput * sizeof(struct output_info));
+	for (k = 0; k < res->noutput; ++k) {
+		struct output_info *output_info = &res->outputs[k];
+
+		output_info->name = arena_strndup(&arena, output_info->name,
+						  output_info->nameLen);
+		output_info->modes = arena_dup(&arena, output_info->modes,
+					       output_info->nmode *
+					       sizeof(RRMode));
+		output_info->edid = output_info->edid_length ?
+		    arena_dup(&arena, output_info->edid,
+			      output_info->edid_length) : NULL;
+		output_bits_freeze(&arena, res, output_info);
+	}
+
+	res->crtcs = arena_dup(&arena, draft->crtcs,
+			       draft->ncrtc * sizeof(struct crtc_info));
+	for (k = 0; k < res->ncrtc; ++k) {
+		struct crtc_info *crtc_info = &res->crtcs[k];
+
+		crtc_info->outputs = arena_dup(&arena, crtc_info->outputs,
+					       crtc_info->noutput *
+					       sizeof(RROutput));
+	}
+
+	return res;
+}
+
+void resources_free(struct resources *res)
+{
+	g_free(res);
+}
+
+XRRModeInfo *resources_find_mode(const struct resources *res, RRMode mode)
+{
+	unsigned int slot;
+
+	for (slot = mode_slot(mode) & res->mode_mask; res->mode_slots[slot];
+	     slot = (slot + 1) & res->mode_mask) {
+		XRRModeInfo *mode_info =
+		    &res->modes[res->mode_slots[slot] - 1];
+
+		if (mode_info->id == mode)
+			return mode_info;
+	}
+
+	return NULL;
+}
+
+/* index of mode_info in res->modes and res->table, -1 if not from res */
+int resources_mode_index(const struct resources *res,
+			 const XRRModeInfo *mode_info)
+{
+	if (mode_info < res->modes || mode_info >= res->modes + res->nmode)
+		return -1;
+
+	return mode_info - res->modes;
+}
+
+struct output_info *resources_find_output(const struct resources *res,
+					  RROutput output)
+{
+	int k;
+
+	for (k = 0; k < res->noutput; ++k) {
+		if (res->outputs[k].id == output)
+			return &res->outputs[k];
+	}
+
+	return NULL;
+}
+
+struct crtc_info *resources_find_crtc(const struct resources *res,
+				      RRCrtc crtc)
+{
+	int k;
+
+	for (k = 0; k < res->ncrtc; ++k) {
+		if (res->crtcs[k].id == crtc)
+			return &res->crtcs[k];
+	}
+
+	return NULL;
+}
+
+/*
+ * Publication. The current snapshot pointer is swapped atomically and
+ * readers never take a lock: they announce the global epoch they entered
+ * in and drop back to zero when leaving. A retired snapshot is freed once
+ * no reader is left in the epoch it was retired in or an older one.
+ */
+struct reader {
+	gint epoch;		/* 0 while quiescent */
+	gint in_use;
+	int nesting;
+	struct reader *next;
+};
+
+struct retired {
+	struct resources *res;
+	gint epoch;
+};
+
+static struct resources *current;
+static gint global_epoch = 1;
+static unsigned long serial;
+static struct reader *readers;
+static GMutex readers_lock;	/* reader registration only */
+static GMutex writer_lock;
+static GArray *retired;
+
+static void reader_release(gpointer data)
+{
+	struct reader *reader = data;
+
+	reader->nesting = 0;
+	g_atomic_int_set(&reader->epoch, 0);
+	g_atomic_int_set(&reader->in_use, 0);
+}
+
+static GPrivate reader_key = G_PRIVATE_INIT(reader_release);
+
+/* reader records are recycled, never freed, so the list can be walked */
+static struct reader *reader_get(void)
+{
+	struct reader *reader = g_private_get(&reader_key);
+
+	if (reader)
+		return reader;
+
+	g_mutex_lock(&readers_lock);
+	for (reader = readers; reader; reader = reader->next) {
+		if (!g_atomic_int_get(&reader->in_use))
+			break;
+	}
+	if (!reader) {
+		reader = g_new0(struct reader, 1);
+		reader->next = readers;
+		g_atomic_pointer_set(&readers, reader);
+	}
+	g_atomic_int_set(&reader->in_use, 1);
+	g_mutex_unlock(&readers_lock);
+
+	g_private_set(&reader_key, reader);
+
+	return reader;
+}
+
+/*
+ * Enter a read side section and return the current snapshot, which stays
+ * valid until the matching resources_read_unlock(). Sections nest.
+ */
+struct resources *resources_read_lock(void)
+{
+	struct reader *reader = reader_get();
+
+	/* the epoch has to be visible before the pointer is loaded */
+	if (!reader->nesting++)
+		g_atomic_int_set(&reader->epoch,
+				 g_atomic_int_get(&global_epoch));
+
+	return g_atomic_pointer_get(&current);
+}
+
+void resources_read_unlock(void)
+{
+	struct reader *reader = g_private_get(&reader_key);
+
+	if (!--reader->nesting)
+		g_atomic_int_set(&reader->epoch, 0);
+}
+
+static void reclaim_locked(void)
+{
+	struct reader *reader;
+	gint oldest = G_MAXINT;
+	int k;
+
+	for (reader = g_atomic_pointer_get(&readers); reader;
+	     reader = reader->next) {
+		gint epoch = g_atomic_int_get(&reader->epoch);
+
+		if (epoch && epoch < oldest)
+			oldest = epoch;
+	}
+
+	for (k = retired->len - 1; k >= 0; --k) {
+		struct retired *r = &g_array_index(retired, struct retired, k);
+
+		if (r->epoch < oldest) {
+			resources_free(r->res);
+			g_array_remove_index_fast(retired, k);
+		}
+	}
+}
+
+/*
+ * Make res the current snapshot and take ownership of it. Readers that
+ * entered before see the previous snapshot until they leave, later ones
+ * see res; nobody sees anything in between.
+ */
+void resources_publish(struct resources *res)
+{
+	struct resources *old;
+
+	g_mutex_lock(&writer_lock);
+
+	if (!retired)
+		retired = g_array_new(FALSE, FALSE, sizeof(struct retired));
+
+	res->serial = ++serial;
+	old = g_atomic_pointer_get(&current);
+	g_atomic_pointer_set(&current, res);
+
+	if (old) {
+		struct retired r = {
+			.res = old,
+			.epoch = g_atomic_int_get(&global_epoch),
+		};
+
+		g_array_append_val(retired, r);
+	}
+
+	/* readers entering from now on cannot get hold of old anymore */
+	g_atomic_int_inc(&global_epoch);
+
+	reclaim_locked();
+
+	g_mutex_unlock(&writer_lock);
+}
+
+/* free retired snapshots that the last readers have let go of */
+void resources_reclaim(void)
+{
+	g_mutex_lock(&writer_lock);
+	if (retired)
+		reclaim_locked();
+	g_mutex_unlock(&writer_lock);
+}
@@ -0,0 +1,249 @@
+/*
+ * sweep.c
+ *
+ * Mode sweep benchmark: apply every mode of an output in turn through
+ * the apply worker, record how long the server took and whether it
+ * succeeded, then go back to the mode the output started in.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+struct sweep {
+	RROutput output;
+	RRMode original;
+	GArray *results;	/* struct sweep_result, in sweep order */
+	unsigned int next;
+	gint64 start;
+	sweep_done_func done;
+	gpointer user_data;
+};
+
+static unsigned int sort_width, sort_height;
+
+/*
+ * Modes of the size the output is in come first, so the sweep starts
+ * without a resize, the other sizes follow from small to large. Each
+ * size is visited once, within one size the server's order is kept.
+ */
+static int result_cmp(const void *a, const void *b)
+{
+	const struct sweep_result *ra = a;
+	const struct sweep_result *rb = b;
+	int a_other = ra->width != sort_width || ra->height != sort_height;
+	int b_other = rb->width != sort_width || rb->height != sort_height;
+	guint64 a_area = (guint64)ra->width * ra->height;
+	guint64 b_area = (guint64)rb->width * rb->height;
+
+	if (a_other != b_other)
+		return a_other - b_other;
+	if (a_area != b_area)
+		return a_area < b_area ? -1 : 1;
+	if (ra->width != rb->width)
+		return ra->width < rb->width ? -1 : 1;
+	if (ra->height != rb->height)
+		return ra->height < rb->height ? -1 : 1;
+
+	return ra->index - rb->index;
+}
+
+static void sweep_free(struct sweep *sweep)
+{
+	unsigned int k;
+
+	for (k = 0; k < sweep->results->len; ++k)
+		g_free(g_array_index(sweep->results, struct sweep_result,
+				     k).name);
+	g_array_free(sweep->results, TRUE);
+	g_free(sweep);
+}
+
+static void sweep_step(struct sweep *sweep);
+
+static void sweep_restored(RROutput output, RRMode mode, int status,
+			   gboolean skipped, gint64 reply_time,
+			   gpointer user_data)
+{
+	struct sweep *sweep = user_data;
+
+	if (status)
+		g_warning("restoring mode 0x%x on output 0x%x failed (%d)\n",
+			  (unsigned int)mode, (unsigned int)output, status);
+
+	sweep->done(sweep->output, sweep->results, sweep->user_data);
+	sweep_free(sweep);
+}
+
+static void sweep_applied(RROutput output, RRMode mode, int status,
+			  gboolean skipped, gint64 reply_time,
+			  gpointer user_data)
+{
+	struct sweep *sweep = user_data;
+	struct sweep_result *result =
+	    &g_array_index(sweep->results, struct sweep_result, sweep->next);
+
+	result->status = status;
+	result->latency = reply_time - sweep->start;
+
+	sweep->next++;
+	sweep_step(sweep);
+}
+
+static void sweep_step(struct sweep *sweep)
+{
+	struct sweep_result *result;
+
+	if (sweep->next == sweep->results->len) {
+		apply_mode(sweep->output, sweep->original, APPLY_FORCE,
+			   sweep_restored, sweep);
+		return;
+	}
+
+	result = &g_array_index(sweep->results, struct sweep_result,
+				sweep->next);
+	sweep->start = g_get_monotonic_time();
+	apply_mode(sweep->output, result->mode, APPLY_FORCE, sweep_applied,
+		   sweep);
+}
+
+/*
+ * Sweep all modes of output as listed in res, each timing once. If
+ * check is given, the modes it refuses are left out. done is called
+ * from the main loop with the results once the original mode is back;
+ * it must not keep them. Returns -1 if output has no active CRTC to
+ * sweep.
+ */
+int sweep_start(const struct resources *res, RROutput output,
+		sweep_check_func check, gpointer check_data,
+		sweep_done_func done, gpointer user_data)
+{
+	struct output_info *output_info = resources_find_output(res, output);
+	struct crtc_info *crtc_info = NULL;
+	XRRModeInfo *current;
+	struct sweep *sweep;
+	GHashTable *timings;	/* first mode of each timing swept */
+	int k;
+
+	if (output_info)
+		crtc_info = resources_find_crtc(res, output_info->crtc);
+	if (!crtc_info || !crtc_info->mode)
+		return -1;
+
+	sweep = g_new0(struct sweep, 1);
+	sweep->output = output;
+	sweep->original = crtc_info->mode;
+	sweep->done = done;
+	sweep->user_data = user_data;
+	sweep->results = g_array_sized_new(FALSE, TRUE,
+					   sizeof(struct sweep_result),
+					   output_info->nmode);
+	timings = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for (k = 0; k < output_info->nmode; ++k) {
+		XRRModeInfo *mode_info =
+		    resources_find_mode(res, output_info->modes[k]);
+		struct sweep_result result = { 0 };
+		const char *refusal;
+		int index;
+
+		if (!mode_info)
+			continue;
+
+		/* modes sharing a timing are applied once */
+		index = resources_mode_index(res, mode_info);
+		if (!g_hash_table_add(timings,
+				      GINT_TO_POINTER(res->table.timing[index])))
+			continue;
+
+		refusal = check ? check(mode_info, check_data) : NULL;
+		if (refusal) {
+			g_message("skipping %s: %s\n", mode_info->name, refusal);
+			continue;
+		}
+
+		result.index = k;
+		result.mode = mode_info->id;
+		result.name = g_strdup(mode_info->name);
+		result.width = mode_info->width;
+		result.height = mode_info->height;
+		result.refresh = res->table.refresh[index];
+		g_array_append_val(sweep->results, result);
+	}
+	g_hash_table_destroy(timings);
+
+	current = resources_find_mode(res, crtc_info->mode);
+	sort_width = current ? current->width : crtc_info->width;
+	sort_height = current ? current->height : crtc_info->height;
+	qsort(sweep->results->data, sweep->results->len,
+	      sizeof(struct sweep_result), result_cmp);
+
+	sweep_step(sweep);
+
+	return 0;
+}
+
+/* quoted as RFC 4180 has it, names may hold commas, quotes or newlines */
+static void csv_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; ++str) {
+		if (*str == '"')
+			fputc('"', f);
+		fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+void sweep_write_csv(FILE *f, const char *output, GArray *results)
+{
+	unsigned int k;
+
+	fputs("output,mode,name,width,height,refresh_hz,status,latency_us\n",
+	      f);
+	for (k = 0; k < results->len; ++k) {
+		struct sweep_result *result =
+		    &g_array_index(results, struct sweep_result, k);
+
+		csv_string(f, output);
+		fprintf(f, ",0x%x,", (unsigned int)result->mode);
+		csv_string(f, result->name);
+		fprintf(f, ",%u,%u,%.2f,%d,%" G_GINT64_FORMAT "\n",
+			result->width, result->height, result->refresh,
+			result->status, result->latency);
+	}
+}
+
+void sweep_write_json(FILE *f, const char *output, GArray *results)
+{
+	unsigned int k;
+
+	fputs("{\"output\": ", f);
+	json_string(f, output);
+	fputs(", \"sweep\": [", f);
+	for (k = 0; k < results->len; ++k) {
+		struct sweep_result *result =
+		    &g_array_index(results, struct sweep_result, k);
+
+		fprintf(f, "%s\n  {\"mode\": %u, \"name\": ", k ? "," : "",
+			(unsigned int)result->mode);
+		json_string(f, result->name);
+		fprintf(f, ", \"width\": %u, \"height\": %u"
+			", \"refresh_hz\": %.2f, \"status\": %d"
+			", \"latency_us\": %" G_GINT64_FORMAT "}",
+			result->width, result->height, result->refresh,
+			result->status, result->latency);
+	}
+	fputs("\n]}\n", f);
+}
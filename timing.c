@@ -0,0 +1,389 @@
+/*
+ * timing.c
+ *
+ * Timing generator for sinks whose EDID cannot be trusted: VESA CVT,
+ * CVT reduced blanking version 1 and 2, and GTF, progressive only. The
+ * formulas follow the VESA spreadsheets the way cvt(1) and gtf(1)
+ * implement them, so the results match the timings other tools produce.
+ *
+ * Generated mode names carry the method as suffix, e.g.
+ * 1920x1080_60.00_rb2, which is how they are told apart from modes the
+ * driver or the user created.
+ *
+ * Copyright (C) 2017 Dirk Eibach, Guntermann & Drunck GmbH <eibach@gdsys.de>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+
+#include "gresolutions.h"
+
+/* CVT */
+#define CVT_H_GRANULARITY 8
+#define CVT_MIN_V_PORCH 3
+#define CVT_MIN_V_BPORCH 6
+#define CVT_CLOCK_STEP 250	/* kHz */
+#define CVT_MIN_VSYNC_BP 550.0	/* us */
+#define CVT_HSYNC_PERCENTAGE 8
+/* C' and M' of the blanking formula */
+#define CVT_C_PRIME 30.0
+#define CVT_M_PRIME 300.0
+
+/* reduced blanking */
+#define CVT_RB_MIN_VBLANK 460.0	/* us */
+#define CVT_RB_H_SYNC 32
+#define CVT_RB_H_BLANK 160
+#define CVT_RB_VFPORCH 3
+#define CVT_RB2_H_BLANK 80
+#define CVT_RB2_H_FPORCH 8
+#define CVT_RB2_V_SYNC 8
+#define CVT_RB2_MIN_VFPORCH 1
+
+/* GTF, default parameters */
+#define GTF_CELL_GRAN 8
+#define GTF_MIN_PORCH 1
+#define GTF_V_SYNC 3
+#define GTF_H_SYNC_PERCENTAGE 8.0
+#define GTF_MIN_VSYNC_BP 550.0	/* us */
+#define GTF_C_PRIME 30.0
+#define GTF_M_PRIME 300.0
+
+static const char *const method_names[] = {
+	[TIMING_CVT] = "cvt",
+	[TIMING_CVT_RB] = "rb",
+	[TIMING_CVT_RB2] = "rb2",
+	[TIMING_GTF] = "gtf",
+};
+
+const char *timing_method_name(enum timing_method method)
+{
+	return method_names[method];
+}
+
+int timing_method_parse(const char *name, enum timing_method *method)
+{
+	unsigned int k;
+
+	for (k = 0; k < G_N_ELEMENTS(method_names); ++k) {
+		if (!g_ascii_strcasecmp(name, method_names[k])) {
+			*method = k;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* CVT encodes the aspect ratio in the vsync width */
+static unsigned int cvt_vsync(unsigned int hdisplay, unsigned int vdisplay)
+{
+	if (!(vdisplay % 3) && vdisplay * 4 / 3 == hdisplay)
+		return 4;
+	if (!(vdisplay % 9) && vdisplay * 16 / 9 == hdisplay)
+		return 5;
+	if (!(vdisplay % 10) && vdisplay * 16 / 10 == hdisplay)
+		return 6;
+	if (!(vdisplay % 4) && vdisplay * 5 / 4 == hdisplay)
+		return 7;
+	if (!(vdisplay % 9) && vdisplay * 15 / 9 == hdisplay)
+		return 7;
+
+	return 10;
+}
+
+static void cvt(XRRModeInfo *m, unsigned int width, unsigned int height,
+		double refresh)
+{
+	unsigned int vsync, vsync_bp, hblank;
+	double hperiod, hblank_percentage;
+	unsigned long clock;
+
+	m->width = width - width % CVT_H_GRANULARITY;
+	m->height = height;
+	vsync = cvt_vsync(m->width, m->height);
+
+	hperiod = (1000000.0 / refresh - CVT_MIN_VSYNC_BP) /
+	    (m->height + CVT_MIN_V_PORCH);
+
+	vsync_bp = CVT_MIN_VSYNC_BP / hperiod + 1;
+	if (vsync_bp < vsync + CVT_MIN_V_BPORCH)
+		vsync_bp = vsync + CVT_MIN_V_BPORCH;
+	m->vTotal = m->height + vsync_bp + CVT_MIN_V_PORCH;
+
+	hblank_percentage = CVT_C_PRIME - CVT_M_PRIME * hperiod / 1000.0;
+	if (hblank_percentage < 20)
+		hblank_percentage = 20;
+	hblank = m->width * hblank_percentage / (100.0 - hblank_percentage);
+	hblank -= hblank % (2 * CVT_H_GRANULARITY);
+	m->hTotal = m->width + hblank;
+
+	m->hSyncEnd = m->width + hblank / 2;
+	m->hSyncStart = m->hSyncEnd - m->hTotal * CVT_HSYNC_PERCENTAGE / 100;
+	m->hSyncStart += CVT_H_GRANULARITY - m->hSyncStart % CVT_H_GRANULARITY;
+	m->vSyncStart = m->height + CVT_MIN_V_PORCH;
+	m->vSyncEnd = m->vSyncStart + vsync;
+
+	clock = m->hTotal * 1000.0 / hperiod;
+	clock -= clock % CVT_CLOCK_STEP;
+	m->dotClock = clock * 1000;
+	m->modeFlags = RR_HSyncNegative | RR_VSyncPositive;
+}
+
+static void cvt_rb(XRRModeInfo *m, unsigned int width, unsigned int height,
+		   double refresh)
+{
+	unsigned int vsync, vbilines;
+	double hperiod;
+	unsigned long clock;
+
+	m->width = width - width % CVT_H_GRANULARITY;
+	m->height = height;
+	vsync = cvt_vsync(m->width, m->height);
+
+	hperiod = (1000000.0 / refresh - CVT_RB_MIN_VBLANK) / m->height;
+
+	vbilines = CVT_RB_MIN_VBLANK / hperiod + 1;
+	if (vbilines < CVT_RB_VFPORCH + vsync + CVT_MIN_V_BPORCH)
+		vbilines = CVT_RB_VFPORCH + vsync + CVT_MIN_V_BPORCH;
+	m->vTotal = m->height + vbilines;
+
+	m->hTotal = m->width + CVT_RB_H_BLANK;
+	m->hSyncEnd = m->width + CVT_RB_H_BLANK / 2;
+	m->hSyncStart = m->hSyncEnd - CVT_RB_H_SYNC;
+	m->vSyncStart = m->height + CVT_RB_VFPORCH;
+	m->vSyncEnd = m->vSyncStart + vsync;
+
+	clock = m->hTotal * 1000.0 / hperiod;
+	clock -= clock % CVT_CLOCK_STEP;
+	m->dotClock = clock * 1000;
+	m->modeFlags = RR_HSyncPositive | RR_VSyncNegative;
+}
+
+/* version 2 has no granularity and derives the clock from the refresh */
+static void cvt_rb2(XRRModeInfo *m, unsigned int width, unsigned int height,
+		    double refresh)
+{
+	unsigned int vbilines;
+	double hperiod;
+
+	m->width = width;
+	m->height = height;
+
+	hperiod = (1000000.0 / refresh - CVT_RB_MIN_VBLANK) / m->height;
+
+	vbilines = CVT_RB_MIN_VBLANK / hperiod + 1;
+	if (vbilines < CVT_RB2_MIN_VFPORCH + CVT_RB2_V_SYNC + CVT_MIN_V_BPORCH)
+		vbilines = CVT_RB2_MIN_VFPORCH + CVT_RB2_V_SYNC +
+		    CVT_MIN_V_BPORCH;
+	m->vTotal = m->height + vbilines;
+
+	m->hTotal = m->width + CVT_RB2_H_BLANK;
+	m->hSyncStart = m->width + CVT_RB2_H_FPORCH;
+	m->hSyncEnd = m->hSyncStart + CVT_RB_H_SYNC;
+	/* the back porch is fixed, the front porch takes the rest */
+	m->vSyncStart = m->vTotal - CVT_MIN_V_BPORCH - CVT_RB2_V_SYNC;
+	m->vSyncEnd = m->vSyncStart + CVT_RB2_V_SYNC;
+
+	/* in steps of 1 kHz */
+	m->dotClock = (unsigned long)(refresh * m->hTotal * m->vTotal / 1000.0) *
+	    1000;
+	m->modeFlags = RR_HSyncPositive | RR_VSyncNegative;
+}
+
+static void gtf(XRRModeInfo *m, unsigned int width, unsigned int height,
+		double refresh)
+{
+	double hperiod_est, hperiod, vfield_rate_est, duty_cycle;
+	unsigned int vsync_bp, hblank, hsync;
+
+	m->width = rint(width / (double)GTF_CELL_GRAN) * GTF_CELL_GRAN;
+	m->height = height;
+
+	hperiod_est = (1.0 / refresh - GTF_MIN_VSYNC_BP / 1000000.0) /
+	    (m->height + GTF_MIN_PORCH) * 1000000.0;
+	vsync_bp = rint(GTF_MIN_VSYNC_BP / hperiod_est);
+	m->vTotal = m->height + vsync_bp + GTF_MIN_PORCH;
+
+	/* correct the line period for the refresh actually asked for */
+	vfield_rate_est = 1.0 / hperiod_est / m->vTotal * 1000000.0;
+	hperiod = hperiod_est / (refresh / vfield_rate_est);
+
+	duty_cycle = GTF_C_PRIME - GTF_M_PRIME * hperiod / 1000.0;
+	hblank = rint(m->width * duty_cycle / (100.0 - duty_cycle) /
+		      (2 * GTF_CELL_GRAN)) * (2 * GTF_CELL_GRAN);
+	m->hTotal = m->width + hblank;
+	hsync = rint(GTF_H_SYNC_PERCENTAGE / 100.0 * m->hTotal /
+		     GTF_CELL_GRAN) * GTF_CELL_GRAN;
+
+	m->hSyncStart = m->width + hblank / 2 - hsync;
+	m->hSyncEnd = m->hSyncStart + hsync;
+	m->vSyncStart = m->height + GTF_MIN_PORCH;
+	m->vSyncEnd = m->vSyncStart + GTF_V_SYNC;
+
+	/* MHz from the line period in us, kept to 1 kHz */
+	m->dotClock = (unsigned long)(m->hTotal / hperiod * 1000.0) * 1000;
+	m->modeFlags = RR_HSyncNegative | RR_VSyncPositive;
+}
+
+/*
+ * Fill mode_info with the timing for width x height at refresh Hz. The
+ * name is allocated, g_free() it. Returns -1 for sizes or rates the
+ * formulas cannot handle; check the result with timing_validate().
+ */
+int timing_generate(enum timing_method method, unsigned int width,
+		    unsigned int height, double refresh,
+		    XRRModeInfo *mode_info)
+{
+	memset(mode_info, 0, sizeof(*mode_info));
+
+	/* the vertical blanking alone has to fit into a frame */
+	if (width < CVT_H_GRANULARITY || !height || refresh <= 0 ||
+	    1000000.0 / refresh <= CVT_MIN_VSYNC_BP)
+		return -1;
+
+	switch (method) {
+	case TIMING_CVT:
+		cvt(mode_info, width, height, refresh);
+		break;
+	case TIMING_CVT_RB:
+		cvt_rb(mode_info, width, height, refresh);
+		break;
+	case TIMING_CVT_RB2:
+		cvt_rb2(mode_info, width, height, refresh);
+		break;
+	case TIMING_GTF:
+		gtf(mode_info, width, height, refresh);
+		break;
+	}
+
+	mode_info->name = g_strdup_printf("%ux%u_%.2f_%s", mode_info->width,
+					  mode_info->height, refresh,
+					  method_names[method]);
+	mode_info->nameLength = strlen(mode_info->name);
+
+	return 0;
+}
+
+/*
+ * Returns why mode_info is not a usable timing, NULL if it is: syncs
+ * have to lie within the blanking and the frame rate has to come out
+ * within 1% of what the name asks for.
+ */
+const char *timing_validate(const XRRModeInfo *mode_info)
+{
+	struct mode_metrics m;
+	double refresh;
+	char *p;
+
+	if (!mode_info->width || !mode_info->height || !mode_info->dotClock)
+		return "empty timing";
+	if (mode_info->hSyncStart < mode_info->width ||
+	    mode_info->hSyncEnd <= mode_info->hSyncStart ||
+	    mode_info->hTotal < mode_info->hSyncEnd)
+		return "horizontal sync outside the blanking";
+	if (mode_info->vSyncStart < mode_info->height ||
+	    mode_info->vSyncEnd <= mode_info->vSyncStart ||
+	    mode_info->vTotal < mode_info->vSyncEnd)
+		return "vertical sync outside the blanking";
+
+	mode_metrics_get(NULL, mode_info, &m);
+	p = strchr(mode_info->name, '_');
+	if (p) {
+		refresh = strtod(p + 1, NULL);
+		if (fabs(m.refresh - refresh) > refresh * 0.01)
+			return "refresh rate off";
+	}
+
+	return NULL;
+}
+
+/* whether mode_info came out of timing_generate() */
+int timing_generated(const XRRModeInfo *mode_info)
+{
+	const char *p = strrchr(mode_info->name, '_');
+	enum timing_method method;
+
+	return p && p != mode_info->name && strchr(mode_info->name, '_') != p &&
+	    !timing_method_parse(p + 1, &method);
+}
+
+/*
+ * WIDTHxHEIGHT@REFRESH, optionally followed by :METHOD, CVT if not
+ * given. Returns -1 if spec does not parse.
+ */
+int timing_spec_parse(const char *spec, unsigned int *width,
+		      unsigned int *height, double *refresh,
+		      enum timing_method *method)
+{
+	char name[8];
+	int n;
+
+	*method = TIMING_CVT;
+
+	n = sscanf(spec, "%ux%u@%lf:%7s", width, height, refresh, name);
+	if (n < 3)
+		return -1;
+	if (n == 4 && timing_method_parse(name, method))
+		return -1;
+
+	return 0;
+}
+
+/* in the form xrandr --newmode takes */
+void timing_modeline_print(FILE *f, const XRRModeInfo *mode_info)
+{
+	fprintf(f, "\"%s\" %.3f %u %u %u %u %u %u %u %u %chsync %cvsync\n",
+		mode_info->name, mode_info->dotClock / 1000000.0,
+		mode_info->width, mode_info->hSyncStart, mode_info->hSyncEnd,
+		mode_info->hTotal, mode_info->height, mode_info->vSyncStart,
+		mode_info->vSyncEnd, mode_info->vTotal,
+		mode_info->modeFlags & RR_HSyncPositive ? '+' : '-',
+		mode_info->modeFlags & RR_VSyncPositive ? '+' : '-');
+}
+
+/*
+ * Print the modelines for specs to stdout, see timing_spec_parse().
+ * Returns the process exit status.
+ */
+int timing_print(char **specs)
+{
+	int status = 0;
+
+	for (; *specs; ++specs) {
+		enum timing_method method;
+		unsigned int width, height;
+		double refresh;
+		XRRModeInfo mode_info;
+		const char *error;
+
+		if (timing_spec_parse(*specs, &width, &height, &refresh,
+				      &method) ||
+		    timing_generate(method, width, height, refresh,
+				    &mode_info)) {
+			fprintf(stderr, "%s: cannot generate a timing\n",
+				*specs);
+			status = 1;
+			continue;
+		}
+
+		error = timing_validate(&mode_info);
+		if (error) {
+			fprintf(stderr, "%s: %s\n", *specs, error);
+			status = 1;
+		} else {
+			timing_modeline_print(stdout, &mode_info);
+		}
+		g_free(mode_info.name);
+	}
+
+	return status;
+}